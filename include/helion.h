@@ -42,5 +42,15 @@
 #include "helion/ast.h"
 #include "helion/util.h"
 #include "helion/pstate.h"
+#include "helion/source.h"
+#include "helion/scan.h"
+#include "helion/thread_pool.h"
+#include "helion/atom.h"
+#include "helion/pcomb.h"
+#include "helion/flat_ast.h"
+#include "helion/incremental.h"
+#include "helion/ast_cache.h"
+#include "helion/resolve.h"
+#include "helion/printer.h"
 
 #endif // CEDAR_HH
@@ -5,10 +5,12 @@
 #ifndef __HELION_AST_H__
 #define __HELION_AST_H__
 
+#include <helion/atom.h>
 #include <helion/text.h>
 #include <helion/tokenizer.h>
 #include <helion/util.h>
 #include <helion/core.h>
+#include <memory>
 #include <vector>
 
 
@@ -37,11 +39,44 @@ namespace helion {
   namespace ast {
 
 
-#define NODE_FOOTER                                         \
- public:                                                    \
-  using node::node;                                         \
-  llvm::Value *codegen(cg_ctx &, cg_scope *, cg_options *); \
-  text str(int depth = 0);
+    /**
+     * every concrete node class has a kind, so passes can switch on it or use
+     * isa<T> and dyn_cast<T> below instead of going through RTTI. The last
+     * few kinds only appear in the flat representation (<helion/flat_ast.h>)
+     */
+    enum class node_kind : uint8_t {
+      number,
+      binary_op,
+      dot,
+      subscript,
+      call,
+      tuple,
+      string,
+      keyword,
+      nil,
+      do_block,
+      return_node,
+      type_node,
+      var_decl,
+      var,
+      prototype,
+      func,
+      def,
+      if_node,
+      typedef_node,
+      typeassert,
+
+      // one condition of an if_node, and one field of a typedef_node
+      if_condition,
+      field,
+    };
+
+
+#define NODE_FOOTER(name)                                            \
+ public:                                                             \
+  static constexpr node_kind static_kind = node_kind::name;          \
+  inline name(scope *s) : node(s, static_kind) {}                    \
+  llvm::Value *codegen(cg_ctx &, cg_scope *, cg_options *);
 
     // @abstract, all ast::nodes extend from this publically
     class node {
@@ -52,8 +87,11 @@ namespace helion {
 
      public:
       scope *scp;
+      const node_kind kind;
+      // scratch space for ast::flatten, to find nodes it has already laid out
+      uint32_t flat_id = ~0u;
 
-      node(scope *s) { scp = s; }
+      node(scope *s, node_kind k) : scp(s), kind(k) {}
       virtual ~node() {}
       inline void set_bounds(token s, token e) {
         start = s;
@@ -69,7 +107,13 @@ namespace helion {
         return error;
       }
 
-      virtual text str(int depth = 0) { return ""; };
+      // the node in helion syntax, indented `depth` levels. ast::print
+      // (<helion/printer.h>) writes it, or the sexpr or json form, to a
+      // stream instead
+      text str(int depth = 0);
+
+      inline token first_token(void) const { return start; }
+      inline token last_token(void) const { return end; }
 
       // virtual void codegen(void);
     };
@@ -78,6 +122,26 @@ namespace helion {
     using node_ptr = rc<node>;
 
 
+    // LLVM style casts that check the node's kind instead of using RTTI
+    template <typename T>
+    inline bool isa(const node *n) {
+      return n != nullptr && n->kind == T::static_kind;
+    }
+    template <typename T>
+    inline bool isa(const node_ptr &n) {
+      return isa<T>(n.get());
+    }
+
+    template <typename T>
+    inline T *dyn_cast(node *n) {
+      return isa<T>(n) ? static_cast<T *>(n) : nullptr;
+    }
+    template <typename T>
+    inline rc<T> dyn_cast(const node_ptr &n) {
+      return isa<T>(n) ? std::static_pointer_cast<T>(n) : nullptr;
+    }
+
+
     class number : public node {
      public:
       enum num_type {
@@ -89,7 +153,7 @@ namespace helion {
         int64_t integer;
         double floating;
       } as;
-      NODE_FOOTER;
+      NODE_FOOTER(number);
     };
 
 
@@ -100,7 +164,7 @@ namespace helion {
       node_ptr left;
       node_ptr right;
       text op;
-      NODE_FOOTER;
+      NODE_FOOTER(binary_op);
     };
 
 
@@ -108,15 +172,15 @@ namespace helion {
     class dot : public node {
      public:
       node_ptr expr;
-      text sub;
-      NODE_FOOTER;
+      atom sub;
+      NODE_FOOTER(dot);
     };
 
     class subscript : public node {
      public:
       node_ptr expr;
       std::vector<node_ptr> subs;
-      NODE_FOOTER;
+      NODE_FOOTER(subscript);
     };
 
 
@@ -125,32 +189,32 @@ namespace helion {
      public:
       node_ptr func;
       std::vector<node_ptr> args;
-      NODE_FOOTER;
+      NODE_FOOTER(call);
     };
 
     class tuple : public node {
      public:
       std::vector<node_ptr> vals;
-      NODE_FOOTER;
+      NODE_FOOTER(tuple);
     };
 
 
     class string : public node {
      public:
       text val;
-      NODE_FOOTER;
+      NODE_FOOTER(string);
     };
 
 
     class keyword : public node {
      public:
       text val;
-      NODE_FOOTER;
+      NODE_FOOTER(keyword);
     };
 
     class nil : public node {
      public:
-      NODE_FOOTER;
+      NODE_FOOTER(nil);
     };
 
 
@@ -158,7 +222,7 @@ namespace helion {
     class do_block : public node {
      public:
       std::vector<node_ptr> exprs;
-      NODE_FOOTER;
+      NODE_FOOTER(do_block);
     };
 
 
@@ -166,7 +230,7 @@ namespace helion {
     class return_node : public node {
      public:
       node_ptr val;
-      NODE_FOOTER;
+      NODE_FOOTER(return_node);
     };
 
 
@@ -178,13 +242,13 @@ namespace helion {
       bool constant = false;
       bool parameter = false;
 
-      text name;
+      atom name;
 
       type_style style = type_style::OBJECT;
       // type parameters, like Vector{Int} where Int would live in here.
       std::vector<rc<type_node>> params;
 
-      NODE_FOOTER;
+      NODE_FOOTER(type_node);
     };
 
 
@@ -192,15 +256,22 @@ namespace helion {
 
     class var_decl : public node {
      public:
+      static constexpr node_kind static_kind = node_kind::var_decl;
+      // declarations are numbered in the order they're created, in each
+      // module (see scope::take_decl_index)
       var_decl(scope *s);
 
       bool global = false;
       int ind = 0;
       bool is_arg = false;
+      // where the variable lives, set by ast::resolve (<helion/resolve.h>).
+      // `depth` is how many functions deep its frame is and `slot` is its
+      // index in that frame. Both are -1 for globals
+      int depth = -1;
+      int slot = -1;
       std::shared_ptr<type_node> type;
-      text name;
+      atom name;
       std::shared_ptr<ast::node> value;
-      text str(int = 0);
       llvm::Value *codegen(cg_ctx &, cg_scope *, cg_options *);
     };
 
@@ -208,9 +279,13 @@ namespace helion {
     class var : public node {
      public:
       bool global = false;
-      text global_name;
+      atom global_name;
       std::shared_ptr<var_decl> decl;
-      NODE_FOOTER;
+      // how many frames up from the one it's used in the variable lives, and
+      // its slot there. -1 if it has to be looked up by name
+      int depth = -1;
+      int slot = -1;
+      NODE_FOOTER(var);
     };
 
 
@@ -226,28 +301,54 @@ namespace helion {
 
       // rc<type_node> return_type;
 
-      NODE_FOOTER;
+      NODE_FOOTER(prototype);
     };
 
 
     // represents function info. Basically, a common representation
     // of escaping variables, closed variables, prototypes, etc..
+    // where the parser left a function body it skipped. Defined in parser.cpp
+    struct lazy_body;
+
     class func : public node {
+      std::shared_ptr<lazy_body> m_lazy;
+
      public:
       // a vector of the variables which this function captures
       std::vector<std::shared_ptr<ast::var_decl>> caputures;
       std::shared_ptr<prototype> proto = nullptr;
+      // empty until parse_body is called if the body was skipped
       std::vector<std::shared_ptr<ast::node>> stmts;
 
       bool anonymous = false;
-      NODE_FOOTER;
+
+      // how many functions this one is nested in (the module's entry is 0)
+      // and how many slots its frame needs. Set by ast::resolve
+      int depth = -1;
+      uint32_t frame_size = 0;
+
+      // leave the body to be parsed by the first parse_body call
+      inline void defer_body(std::shared_ptr<lazy_body> l) {
+        std::atomic_store(&m_lazy, l);
+      }
+      inline bool body_parsed(void) const {
+        return std::atomic_load(&m_lazy) == nullptr;
+      }
+      /**
+       * parse the body if the parser skipped it, filling in stmts. Safe to
+       * call from several threads. Syntax errors in a skipped body are thrown
+       * from here rather than when the module was parsed
+       */
+      void parse_body(void);
+
+      NODE_FOOTER(func);
     };
 
     class def : public node {
      public:
-      text name;
+      atom name;
       std::shared_ptr<func> fn;
-      NODE_FOOTER;
+      NODE_FOOTER(def);
     };
 
 
@@ -261,7 +362,7 @@ namespace helion {
       bool has_default = false;
 
       std::vector<condition> conds;
-      NODE_FOOTER;
+      NODE_FOOTER(if_node);
     };
 
 
@@ -270,14 +371,17 @@ namespace helion {
      public:
       struct field_t {
         std::shared_ptr<ast::type_node> type;
-        text name;
+        atom name;
       };
       std::shared_ptr<type_node> type;
       std::shared_ptr<type_node> extends;
       std::vector<field_t> fields;
       std::vector<std::shared_ptr<ast::def>> defs;
+      // `type value Name`: stored inline in the objects and slices that
+      // hold it instead of behind a pointer
+      bool value = false;
 
-      NODE_FOOTER;
+      NODE_FOOTER(typedef_node);
     };
 
 
@@ -286,7 +390,7 @@ namespace helion {
      public:
       std::shared_ptr<ast::node> val;
       std::shared_ptr<ast::type_node> type;
-      NODE_FOOTER;
+      NODE_FOOTER(typeassert);
     };
 
 
@@ -300,6 +404,9 @@ namespace helion {
     class module {
      private:
       std::unique_ptr<scope> m_scope;
+      // the scopes of modules that were merged into this one, which their
+      // nodes still point into
+      std::vector<std::unique_ptr<scope>> m_merged;
 
      public:
       module();
@@ -312,6 +419,10 @@ namespace helion {
 
       scope *get_scope(void);
       text str(int = 0);
+
+      // append another module's typedefs, defs and top level statements to
+      // this one's, taking ownership of everything they refer to
+      void merge(std::unique_ptr<module>);
     };
 
 
@@ -0,0 +1,73 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_AST_CACHE_H__
+#define __HELION_AST_CACHE_H__
+
+#include <helion/flat_ast.h>
+#include <helion/source.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+namespace helion {
+
+
+  /**
+   * a directory of parsed modules, so an unchanged file doesn't have to be
+   * parsed again every time the compiler starts. An entry is a module in its
+   * flat form (<helion/flat_ast.h>) written out as is, keyed by a hash of
+   * the source's bytes and the cache version. Loading one maps the entry,
+   * copies each array out of it while turning the stored names back into
+   * atoms and the stored offsets back into locations in the file, and then
+   * builds the module's tree from the flat form with unflatten. That's
+   * linear in the size of the tree, but skips the tokenizer and the parser.
+   *
+   * The cache is best effort. Entries that are missing, stale or don't make
+   * sense are parsed again, and failing to write one isn't an error. Using
+   * one cache from several threads or processes is safe
+   */
+  class ast_cache {
+    std::string m_dir;
+
+   public:
+    // bump this whenever a change to the parser or the flat form changes
+    // what a source turns into, which makes every existing entry stale
+    static constexpr uint32_t version = 2;
+
+    explicit ast_cache(std::string dir);
+
+    inline const std::string &dir(void) const { return m_dir; }
+
+    // the entry for a source, valid or not
+    std::string path_for(source_file *);
+
+    // the cached module for a source, or nullptr if there isn't a valid one
+    std::unique_ptr<ast::module> load(source_file *);
+    // write a module parsed from a source. Returns whether it was written
+    bool store(source_file *, ast::module &);
+
+    // load a source's module, parsing and storing it if it isn't cached.
+    // `streaming` is passed on to parse_module
+    std::unique_ptr<ast::module> parse(source_file *, bool streaming = false);
+  };
+
+
+  namespace ast {
+    /**
+     * the cache's binary form of a flat module. Locations are stored as
+     * offsets into `file`, and names as strings, so the result means the
+     * same thing in any process
+     */
+    std::string serialize(const flat_module &, source_file *file);
+    // read a serialized flat module back, relocated into `file`. Returns
+    // false if the bytes are not a valid module
+    bool deserialize(const char *data, size_t size, source_file *file,
+                     flat_module &out);
+  }  // namespace ast
+
+}  // namespace helion
+
+#endif
@@ -0,0 +1,68 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_ATOM_H__
+#define __HELION_ATOM_H__
+
+#include <helion/text.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace helion {
+
+
+  /**
+   * an atom is an interned identifier. Every distinct spelling is stored
+   * exactly once in a global table for the life of the process, so an atom
+   * is just a 32 bit id, and comparing or hashing two atoms never has to look
+   * at their bytes. The bytes are null terminated utf8 and never move.
+   *
+   * The tokenizer interns every identifier as it lexes it, and the scopes in
+   * the parser and codegen are keyed on atoms. Interning is thread safe.
+   */
+  class atom {
+    // zero is always the empty atom
+    uint32_t m_id = 0;
+
+   public:
+    atom() = default;
+    atom(std::string_view);
+    inline atom(const char *s) : atom(std::string_view(s)) {}
+    inline atom(const std::string &s) : atom(std::string_view(s)) {}
+    inline atom(const text &t) : atom(t.view()) {}
+
+    // an atom from an id that was previously returned by atom::id
+    static inline atom from_id(uint32_t id) {
+      atom a;
+      a.m_id = id;
+      return a;
+    }
+
+    inline uint32_t id(void) const { return m_id; }
+    inline bool empty(void) const { return m_id == 0; }
+
+    std::string_view view(void) const;
+    inline const char *c_str(void) const { return view().data(); }
+    inline std::string str(void) const { return std::string(view()); }
+
+    inline bool operator==(const atom &o) const { return m_id == o.m_id; }
+    inline bool operator!=(const atom &o) const { return m_id != o.m_id; }
+    // orders by when the atoms were interned, not alphabetically
+    inline bool operator<(const atom &o) const { return m_id < o.m_id; }
+  };
+
+}  // namespace helion
+
+
+namespace std {
+  template <>
+  struct hash<helion::atom> {
+    inline size_t operator()(const helion::atom &a) const { return a.id(); }
+  };
+}  // namespace std
+
+#endif
@@ -55,9 +55,12 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 
+#include <atomic>
 #include <flat_hash_map.hpp>
 #include <mutex>
+#include <unordered_map>
 
+#include <helion/atom.h>
 #include <helion/text.h>
 
 /*
@@ -93,6 +96,10 @@ namespace helion {
   // a linkage to the basic float type
   extern datatype *float32_type;
 
+  // whether object fields are reordered to leave as little padding between
+  // them as possible, rather than kept in the order they're declared
+  extern bool reorder_fields;
+
 
   // a value is an opaque pointer to something garbage collected in the helion
   // jit runtime. It has no real meaning except as a better, typed replacement
@@ -115,6 +122,84 @@ namespace helion {
 
 
 
+  /**
+   * the specializations of one type, hash consed on their parameters. Finding
+   * one doesn't take a lock: slots are written once with a release store, and
+   * growing fills a new table and then publishes it, so a reader sees either
+   * the old table or the new one. Old tables are kept until the set is
+   * destroyed, as a reader may still be probing one.
+   *
+   * Inserting has to be done while holding the typeinfo's lock
+   */
+  class spec_set {
+    struct slot {
+      // written before val is published
+      size_t hash = 0;
+      std::atomic<datatype *> val{nullptr};
+    };
+    struct table {
+      size_t mask = 0;
+      std::unique_ptr<slot[]> slots;
+      // the table this one replaced
+      std::unique_ptr<table> prev;
+    };
+
+    std::atomic<table *> m_table{nullptr};
+    std::unique_ptr<table> m_owned;
+    size_t m_count = 0;
+
+    static void place(table &, size_t hash, datatype *);
+
+   public:
+    datatype *find(size_t hash, const std::vector<datatype *> &) const;
+    void insert(size_t hash, datatype *);
+  };
+
+
+  /**
+   * where the fields of an object live in memory. Every object starts with a
+   * header of two words, its type and its supertype, then (if it has any cold
+   * fields) a pointer to a side object holding those, then the rest of its
+   * fields. Fields are naturally aligned, and unless reorder_fields is off
+   * they're sorted by alignment so there's no padding between them.
+   *
+   * Fields of value types are laid out inline, and value types themselves
+   * have no header and no cold object, just their fields.
+   *
+   * to_llvm builds its struct from this, and allocation sizes come from it,
+   * so codegen and the GC agree on where everything is
+   */
+  struct type_layout {
+    struct place {
+      // bytes from the start of the object (or the cold object)
+      uint32_t offset = 0;
+      // the element of the llvm struct it's in
+      uint32_t index = 0;
+      bool cold = false;
+    };
+
+    // where the pointer to the cold object is, if there is one
+    static constexpr uint32_t cold_offset = 2 * sizeof(void *);
+
+    // one for each of the datatype's fields, in declaration order
+    std::vector<place> fields;
+    // the indices of the fields in the order they're laid out, hot ones
+    // first
+    std::vector<uint32_t> order;
+
+    uint32_t size = 0;
+    uint32_t align = 1;
+    // 0 if there are no cold fields
+    uint32_t cold_size = 0;
+    uint32_t cold_align = 1;
+
+    // what the object would take with every field in declaration order,
+    // and packed without any alignment, which is how objects used to be
+    uint32_t declared_size = 0;
+    uint32_t packed_size = 0;
+  };
+
+
   struct typeinfo {
     // a type can have multiple 'styles'. For example, Int32 has the style of
     // INTEGER, and thne has a size of 32. This is helpful when lowering to
@@ -123,7 +208,14 @@ namespace helion {
     std::shared_ptr<ast::typedef_node> node;
 
     type_style style = type_style::OBJECT;
-    std::string name;
+    atom name;
+
+    // an object that's stored inline in the objects and slices that hold it
+    // rather than allocated on its own. Its layout has no header, as the
+    // type is always known from where it's stored. It's meant to be
+    // immutable, which nothing checks yet, and locals and calls don't treat
+    // it any differently until they're compiled
+    bool value_type = false;
 
     // how many bits this type is in memory (for primitive types)
     int bits;
@@ -134,10 +226,24 @@ namespace helion {
     // the super type of this type. Defaults to any_type
     datatype *super;
 
-    std::vector<std::string> param_names;
+    std::vector<atom> param_names;
+
+    // the id of the unspecialized type that all of this type's
+    // specializations are made from
+    uint32_t base_id = 0;
+
+    // how many supertypes are above this one, and their base ids from the
+    // root down, ending with this type's own. A type's supertype never
+    // changes once it's created, so this is filled in then and never has to
+    // be renumbered. `A` inherits from `B` iff
+    // A.display[B.depth] == B.base_id, without walking the chain
+    uint32_t depth = 0;
+    std::vector<uint32_t> display;
 
     std::vector<std::unique_ptr<datatype>> specializations;
+    spec_set specs;
 
+    // held while adding to specializations and specs
     std::mutex lock;
   };
 
@@ -148,44 +254,78 @@ namespace helion {
   struct datatype {
     struct field {
       datatype *type;
-      std::string name;
+      atom name;
+      // rarely used, so kept in a side object rather than taking up room
+      // in the object itself. Has to be set before the layout is made
+      bool cold = false;
     };
     std::shared_ptr<typeinfo> ti;
 
+    // dense, numbered from 0 in the order types are created. Every
+    // specialization is a type of its own, with its own id
+    uint32_t id = 0;
 
     bool specialized = false;
-    bool completed = false;
+    // set once a specialization's fields are filled in. It can be found
+    // by other threads before then, as a type can refer to itself, but
+    // specialize() only hands it out to them once this is set
+    std::atomic<bool> completed{false};
     // a list of type parameters. ie: Vector<Int>
     std::vector<datatype *> param_types;
     // declaration of the type in LLVM as an llvm::Type
     llvm::Type *type_decl = nullptr;
     std::vector<field> fields;
 
-    static datatype &create(std::string, datatype & = *any_type,
-                            std::vector<std::string> = {});
-    static inline datatype &create(std::string n, std::vector<std::string> p) {
+    static datatype &create(atom, datatype & = *any_type,
+                            std::vector<atom> = {});
+    static inline datatype &create(atom n, std::vector<atom> p) {
       return datatype::create(n, *any_type, p);
     };
 
-    static datatype &create_integer(std::string, int);
-    static datatype &create_float(std::string, int);
+    static datatype &create_integer(atom, int);
+    static datatype &create_float(atom, int);
 
-    void add_field(std::string, datatype *);
+    void add_field(atom, datatype *);
     // datatype *specialize(std::vector<datatype *>);
 
+    // both are made the first time they're asked for, under one lock for
+    // every type, as they recurse into the types of the fields
     llvm::Type *to_llvm(void);
+    // only meaningful for objects
+    const type_layout &layout(void);
 
-    text str(void);
-
-    inline datatype *spawn_spec() {
-      auto n = new datatype(*this);
-      n->specialized = true;
-      ti->specializations.push_back(std::unique_ptr<datatype>(n));
-      return n;
+    inline bool is_value(void) const {
+      return ti->style == type_style::OBJECT && ti->value_type;
     }
+    text str(void);
+    // write the type's name to a stream, without building the string first
+    void print(llvm::raw_ostream &);
+
+    static datatype *from_id(uint32_t);
+
+    /**
+     * the specialization of this type with these parameters, or nullptr.
+     * Specializations are hash consed on (base id, parameter ids), so there
+     * is only ever one for each list of parameters, and two specialized
+     * types are the same iff they're the same pointer. Safe to call from
+     * any thread, without locking
+     */
+    datatype *find_spec(const std::vector<datatype *> &);
+    /**
+     * make a specialization that find_spec will return from now on. If
+     * another thread made it first, that one is returned and `created` is
+     * false, and it's up to that thread to fill in the fields
+     */
+    datatype *spawn_spec(std::vector<datatype *>, bool &created);
 
    private:
-    inline datatype(std::string name, datatype &s) {
+    friend void print_layout_report(llvm::raw_ostream &);
+    std::unique_ptr<type_layout> m_layout;
+    // set while the layout is being made, to catch values that contain
+    // themselves
+    bool m_laying_out = false;
+
+    inline datatype(atom name, datatype &s) {
       ti = std::make_shared<typeinfo>();
       ti->name = name;
       ti->super = &s;
@@ -231,6 +371,8 @@ namespace helion {
 
 
   datatype *specialize(std::shared_ptr<ast::type_node> &, cg_scope *);
+  // safe to call from several threads. The specialization returned always
+  // has its fields filled in
   datatype *specialize(datatype *, std::vector<datatype *>, cg_scope *);
   datatype *specialize(datatype *, cg_scope *);
 
@@ -244,6 +386,10 @@ namespace helion {
   // check if two types are
   bool subtype(datatype *A, datatype *B);
 
+  // write how each object type that's been laid out so far is laid out, and
+  // how many bytes that saved over declaration order
+  void print_layout_report(llvm::raw_ostream &);
+
 
   /**
    * A method signature represents the type of a signature at runtime. It is
@@ -392,7 +538,7 @@ namespace helion {
   // a global_variable is what helion global variables are stored in
   struct global_variable {
     datatype *type;
-    text name;
+    atom name;
     // A pointer to an unknown size of memory. Allocated
     // when the global variable is created. It is enough to store
     // a variable of the type in. ie: with objects, it's large enough
@@ -407,16 +553,16 @@ namespace helion {
   class module {
     // module *parent = nullptr;
     text name;
-    std::map<std::string, std::unique_ptr<global_variable>> globals;
+    std::unordered_map<atom, std::unique_ptr<global_variable>> globals;
 
    public:
     // represents the global scope for this module
     std::unique_ptr<cg_scope> scope;
 
-    global_variable *find(std::string);
+    global_variable *find(atom);
 
     // Returns a pointer to the cell which the value is stored in
-    void *global_create(std::string, datatype *);
+    void *global_create(atom, datatype *);
   };
 
 
@@ -0,0 +1,162 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_FLAT_AST_H__
+#define __HELION_FLAT_AST_H__
+
+#include <helion/ast.h>
+#include <helion/atom.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace helion {
+
+  namespace ast {
+
+    // nodes in a flat_module refer to each other by their index
+    using node_id = uint32_t;
+    constexpr node_id no_node = ~(node_id)0;
+
+
+    /**
+     * the flat form of an ast node. What the fields mean depends on the kind,
+     * and the children are always a contiguous run of the module's `children`
+     * array. A missing child (an if without a condition, a method type with
+     * no return type, ...) is no_node.
+     *
+     *   kind          children                    data            aux
+     *   number        -                           numbers index   -
+     *   binary_op     left, right                 op atom         -
+     *   dot           expr                        sub atom        -
+     *   subscript     expr, subs...               -               -
+     *   call          func, args...               -               -
+     *   tuple         vals...                     -               -
+     *   string        -                           texts index     -
+     *   keyword       -                           texts index     -
+     *   nil           -                           -               -
+     *   do_block      exprs...                    -               -
+     *   return_node   val?                        -               -
+     *   type_node     params...                   name atom       type_style
+     *   var_decl      type, value                 name atom       var index
+     *   var           -                           name atom       decl node
+     *   prototype     type, args...               -               -
+     *   func          proto, stmts..., captures.. -               stmt count
+     *   def           fn                          name atom       -
+     *   if_node       if_conditions...            -               -
+     *   if_condition  cond, body...               -               -
+     *   typedef_node  type, extends, fields...,   -               field count
+     *                 defs...
+     *   field         type                        name atom       -
+     *   typeassert    val, type                   -               -
+     */
+    struct flat_node {
+      node_kind kind;
+      uint8_t flags = 0;
+      uint32_t first = 0;
+      uint32_t count = 0;
+      uint32_t data = 0;
+      uint32_t aux = 0;
+      // where the node starts in the source
+      source_loc loc = 0;
+    };
+
+    static_assert(sizeof(flat_node) == 24, "flat nodes should stay packed");
+
+
+    // the bits of flat_node::flags
+    enum : uint8_t {
+      flat_global = 1 << 0,     // var_decl, var
+      flat_arg = 1 << 1,        // var_decl
+      flat_constant = 1 << 2,   // type_node
+      flat_parameter = 1 << 3,  // type_node
+      flat_floating = 1 << 4,   // number
+      flat_anonymous = 1 << 5,  // func
+      flat_default = 1 << 6,    // if_node
+      flat_value = 1 << 7,      // typedef_node
+    };
+
+
+
+    /**
+     * a whole module's ast laid out in a handful of arrays. Passes that walk
+     * it touch contiguous memory with no reference counting, and throwing it
+     * away is a few frees no matter how many nodes it holds.
+     *
+     * Nodes that were shared in the tree (a prototype's argument types are
+     * also its method type's params, for example) are flattened once and
+     * shared by id, so the flat form is a DAG just like the tree.
+     */
+    class flat_module {
+     public:
+      std::vector<flat_node> nodes;
+      std::vector<node_id> children;
+      // the values of string and keyword literals
+      std::vector<text> texts;
+      // the bits of number literals, an int64_t or a double by flat_floating
+      std::vector<uint64_t> numbers;
+
+      std::vector<node_id> typedefs;
+      std::vector<node_id> defs;
+      node_id entry = no_node;
+
+
+      inline flat_node &operator[](node_id n) { return nodes[n]; }
+      inline node_kind kind(node_id n) const { return nodes[n].kind; }
+      inline uint32_t child_count(node_id n) const { return nodes[n].count; }
+      inline node_id child(node_id n, uint32_t i) const {
+        return children[nodes[n].first + i];
+      }
+      inline const node_id *child_begin(node_id n) const {
+        return children.data() + nodes[n].first;
+      }
+      inline const node_id *child_end(node_id n) const {
+        return child_begin(n) + nodes[n].count;
+      }
+
+      // the name of a node whose data is an atom
+      inline atom name(node_id n) const { return atom::from_id(nodes[n].data); }
+
+      int64_t integer(node_id n) const;
+      double floating(node_id n) const;
+      inline const text &value(node_id n) const { return texts[nodes[n].data]; }
+
+
+      /**
+       * walk the nodes under `root` in preorder without recursing. `fn` is
+       * called as fn(node_id) and returns whether to walk that node's
+       * children. Missing children are skipped
+       */
+      template <typename Fn>
+      void walk(node_id root, Fn &&fn) const {
+        std::vector<node_id> stack;
+        stack.push_back(root);
+        while (!stack.empty()) {
+          node_id n = stack.back();
+          stack.pop_back();
+          if (n == no_node || !fn(n)) continue;
+          // pushed in reverse so they come off the stack in order
+          for (auto *c = child_end(n); c != child_begin(n);) stack.push_back(*--c);
+        }
+      }
+    };
+
+
+    // lay out a parsed module in its flat form
+    flat_module flatten(module &);
+
+    /**
+     * build the tree back up from a flat module. Shared nodes stay shared,
+     * and scopes are rebuilt the way the parser makes them: one for each
+     * function, do block and if condition, with every declaration bound in
+     * the scope it appears in. Nodes only know where they start
+     */
+    std::unique_ptr<module> unflatten(const flat_module &);
+
+  }  // namespace ast
+
+}  // namespace helion
+
+#endif
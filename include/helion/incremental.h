@@ -0,0 +1,106 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_INCREMENTAL_H__
+#define __HELION_INCREMENTAL_H__
+
+#include <helion/parser.h>
+#include <helion/pstate.h>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace helion {
+
+
+  // what an edit did to the top level of a module
+  struct reparse_result {
+    // the top level nodes that were parsed again, in module order. A def or
+    // type in here replaces any of the same name in `removed`
+    std::vector<std::shared_ptr<ast::node>> changed;
+    // the top level nodes that are no longer in the module. The version of
+    // the source they were parsed from is unloaded, so their locations
+    // aren't valid anymore
+    std::vector<std::shared_ptr<ast::node>> removed;
+    // how many top level forms were kept as they were
+    size_t reused = 0;
+    // the scopes the removed nodes were parsed in, which they still point to
+    std::vector<std::unique_ptr<scope>> scopes;
+  };
+
+
+  /**
+   * a module that is kept parsed as its source is edited (a REPL, hot
+   * reloading, a file watcher...). The token stream and the extent of every
+   * top level form are kept, so an edit only lexes the bytes around it, and
+   * only parses the top level forms that looked at a changed token again.
+   * Every other form keeps its nodes and scopes as they were.
+   *
+   * A form is also parsed again if it looked up a name that an earlier form
+   * that changed bound at the top level (ie: a `let`), as its variables
+   * point to the old declaration. Everything else between top level forms
+   * goes by name, so nothing else is invalidated.
+   *
+   * Each version of the source made by an edit goes in a range of
+   * locations the parser reserves, alternating between its two halves, and
+   * is only registered with the source_manager once it parsed. The forms
+   * that are kept are moved over to it and the version before is unloaded,
+   * so a long session doesn't pile up old versions.
+   */
+  class incremental_parser {
+    // a top level form, with its token indices in the current stream
+    struct form {
+      // the first token, and the token just after the form
+      uint32_t first, end;
+      // the furthest token the parser looked at while parsing it
+      uint32_t seen;
+      std::vector<std::shared_ptr<ast::node>> nodes;
+      scope_trace trace;
+      // kept from the version before the last edit, whose locations it
+      // still has
+      bool stale = false;
+    };
+
+    source_file *m_file;
+    // m_file is a version made by an edit, which the next edit unloads
+    bool m_owns_file = false;
+    // the reserved locations, two halves of m_half. The current version is
+    // in one half (m_side) and an edit goes in the other, so the current one
+    // is still loaded if the edit fails
+    source_loc m_range = 0;
+    size_t m_half = 0;
+    bool m_side = false;
+
+    std::shared_ptr<tokenizer> m_tokens;
+    std::unique_ptr<ast::module> m_module;
+    std::vector<form> m_forms;
+
+    reparse_result reparse(std::shared_ptr<tokenizer>, const token_splice &);
+
+   public:
+    // parse all of a file
+    explicit incremental_parser(source_file *);
+    ~incremental_parser();
+
+    incremental_parser(const incremental_parser &) = delete;
+    incremental_parser &operator=(const incremental_parser &) = delete;
+
+    // the module as of the last edit, which edits update in place
+    inline ast::module &module(void) { return *m_module; }
+    // the current version of the source
+    inline source_file *file(void) { return m_file; }
+
+    /**
+     * replace the `removed` bytes at `offset` with `inserted`. If the edited
+     * source fails to lex or parse, the error is thrown and the module is
+     * left as it was before the edit
+     */
+    reparse_result edit(size_t offset, size_t removed,
+                        std::string_view inserted);
+  };
+
+}  // namespace helion
+
+#endif
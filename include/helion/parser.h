@@ -7,12 +7,13 @@
 #define __PARSER_H__
 
 #include <helion/pstate.h>
-#include <functional>
 
 #include <helion/ast.h>
 
 namespace helion {
 
+  class ast_cache;
+
   struct presult {
     using node_ptr = std::shared_ptr<ast::node>;
 
@@ -31,7 +32,11 @@ namespace helion {
 
     template<typename T>
     inline rc<T> as(void) {
-      return std::dynamic_pointer_cast<T>(vals[0]);
+      if constexpr (std::is_same_v<T, ast::node>) {
+        return vals[0];
+      } else {
+        return ast::dyn_cast<T>(vals[0]);
+      }
     }
 
     inline operator pstate(void) { return state; }
@@ -57,8 +62,6 @@ namespace helion {
   };
 
 
-  using parse_func = std::function<presult(pstate)>;
-
   inline presult pfail(pstate s) {
     presult p;
     p.state = s;
@@ -66,43 +69,8 @@ namespace helion {
     return p;
   }
 
-  inline parse_func options(std::vector<parse_func> funcs) {
-    return [funcs](pstate s) -> presult {
-      for (auto& fn : funcs) {
-        auto r = fn(s);
-        if (r) return r;
-      }
-      return pfail(s);
-    };
-  }
-  inline parse_func sequence(std::vector<parse_func> funcs) {
-    return [funcs](pstate s) -> presult {
-      std::vector<std::shared_ptr<ast::node>> emitted;
-      for (auto& fn : funcs) {
-        auto r = fn(s);
-        if (r) {
-          s = r.state;
-          for (auto& v : r.vals) {
-            emitted.push_back(v);
-          }
-        } else {
-          return pfail(s);
-        }
-      }
-      presult p;
-      p.vals = emitted;
-      p.state = s;
-      return p;
-    };
-  }
-
-
-  inline parse_func operator|(parse_func l, parse_func r) {
-    return options({l, r});
-  }
-  inline parse_func operator&(parse_func l, parse_func r) {
-    return sequence({l, r});
-  }
+  // the combinators for building rules out of other rules live in
+  // <helion/pcomb.h>
 
 
   /**
@@ -112,6 +80,37 @@ namespace helion {
    */
   std::unique_ptr<ast::module> parse_module(pstate);
   std::unique_ptr<ast::module> parse_module(text, text);
+  std::unique_ptr<ast::module> parse_module(std::shared_ptr<source_buffer>,
+                                            text);
+  // with `lazy_bodies`, def bodies are skipped until they're needed. With
+  // `streaming`, only the current top level form's tokens are kept around,
+  // unless bodies are skipped, as those are parsed from their tokens later
+  std::unique_ptr<ast::module> parse_module(source_file*,
+                                            bool lazy_bodies = false,
+                                            bool streaming = false);
+
+  /**
+   * parse the single top level form at `s` (a def, a type, a let or any
+   * other expression) into the module's scope `sc`. Throws if there isn't
+   * one there. The state of the result is just past the form
+   */
+  presult parse_top_level(pstate s, scope *sc);
+
+  /**
+   * parse every file on its own tokenizer and scope tree, concurrently on a
+   * pool, and merge the results in the order the files were given. If files
+   * fail to parse, the error of the first of them (in that order) is thrown.
+   * Each file numbers its declarations and inferred type parameters on its
+   * own, so the result doesn't depend on which file finished first.
+   * Files are loaded from and stored to `cache` if there is one, in which
+   * case bodies aren't skipped. `streaming` is as for parse_module, for each
+   * file. Must not be called from a worker of the same pool
+   */
+  std::unique_ptr<ast::module> parse_modules(const std::vector<source_file*>&,
+                                             thread_pool&,
+                                             bool lazy_bodies = false,
+                                             ast_cache* cache = nullptr,
+                                             bool streaming = false);
 
 
 
@@ -125,11 +124,14 @@ namespace helion {
 
     inline syntax_error(pstate s, text msg) {
       token tok = s;
+      position pos = s.position_of(tok);
+      line = pos.line;
+      col = pos.col;
       _msg += s.path();
       _msg += " (";
-      _msg += std::to_string(tok.line+1);
+      _msg += std::to_string(line+1);
       _msg += ":";
-      _msg += std::to_string(tok.col+1);
+      _msg += std::to_string(col+1);
       _msg += ") ";
       _msg += "error: ";
       _msg += msg; 
@@ -139,11 +141,11 @@ namespace helion {
       text indent = "  | ";
 
       _msg += indent;
-      _msg += s.line(tok.line);
+      _msg += s.line(line);
       _msg += "\n";
 
       _msg += indent;
-      for (int i = 0; i < tok.col-1; i++) {
+      for (int i = 0; i < col; i++) {
         _msg += " ";
       }
       _msg += "^\n\n";
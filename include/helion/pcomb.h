@@ -0,0 +1,284 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_PCOMB_H__
+#define __HELION_PCOMB_H__
+
+#include <helion/parser.h>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * parser combinators built out of templates, so a combined parser's type is
+ * the whole grammar it implements and every call through it can be inlined.
+ * Nothing is type erased, and a parser doesn't return its nodes, it appends
+ * them to a node_buf owned by the caller.
+ *
+ * A parser is anything derived from pcomb::parser that has a
+ *
+ *     bool operator()(pstate &s, node_buf &out) const
+ *
+ * On success it advances `s` past what it consumed and appends its nodes to
+ * `out`. On failure it leaves both exactly as it found them, which is what
+ * lets `|` try the next option without any bookkeeping.
+ *
+ * The existing rules, `presult(pstate)`, plug in with pcomb::rule, and
+ * pcomb::run turns a combined parser back into a presult.
+ */
+namespace helion::pcomb {
+
+  using node_ptr = std::shared_ptr<ast::node>;
+
+
+  /**
+   * a vector of nodes that keeps the first few inline. Most rules emit one or
+   * two nodes, so a buffer on the caller's stack rarely touches the heap
+   */
+  class node_buf {
+    static constexpr size_t inline_size = 8;
+    std::array<node_ptr, inline_size> m_inline;
+    std::vector<node_ptr> m_spill;
+    size_t m_size = 0;
+
+   public:
+    inline size_t size(void) const { return m_size; }
+    inline bool empty(void) const { return m_size == 0; }
+
+    inline void push_back(node_ptr n) {
+      if (m_size < inline_size)
+        m_inline[m_size] = std::move(n);
+      else
+        m_spill.push_back(std::move(n));
+      m_size++;
+    }
+
+    inline node_ptr &operator[](size_t i) {
+      return i < inline_size ? m_inline[i] : m_spill[i - inline_size];
+    }
+
+    // drop everything after the first `n` nodes
+    inline void truncate(size_t n) {
+      for (size_t i = n; i < m_size && i < inline_size; i++) m_inline[i] = nullptr;
+      if (m_size > inline_size)
+        m_spill.resize(n > inline_size ? n - inline_size : 0);
+      if (n < m_size) m_size = n;
+    }
+
+    inline std::vector<node_ptr> to_vector(void) {
+      std::vector<node_ptr> v;
+      v.reserve(m_size);
+      for (size_t i = 0; i < m_size; i++) v.push_back((*this)[i]);
+      return v;
+    }
+  };
+
+
+  // the tag that opts a type into the combinator operators
+  struct parser {};
+
+  template <typename T>
+  constexpr bool is_parser = std::is_base_of_v<parser, std::decay_t<T>>;
+
+
+  /**
+   * a parser out of any callable with the parser signature. It must follow
+   * the same rule of leaving the state and buffer alone when it fails
+   */
+  template <typename Fn>
+  struct fn_parser : parser {
+    Fn fn;
+    inline explicit fn_parser(Fn f) : fn(std::move(f)) {}
+    inline bool operator()(pstate &s, node_buf &out) const { return fn(s, out); }
+  };
+
+  template <typename Fn>
+  inline auto make_parser(Fn fn) {
+    return fn_parser<Fn>(std::move(fn));
+  }
+
+
+  /**
+   * adapts a rule written the old way, anything callable as presult(pstate).
+   * A rule that needs a scope is adapted with a lambda that captures it
+   */
+  template <typename Fn>
+  struct rule_parser : parser {
+    Fn fn;
+    inline explicit rule_parser(Fn f) : fn(std::move(f)) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      presult r = fn(s);
+      if (!r) return false;
+      for (auto &v : r.vals) out.push_back(v);
+      s = r.state;
+      return true;
+    }
+  };
+
+  template <typename Fn>
+  inline auto rule(Fn fn) {
+    return rule_parser<Fn>(std::move(fn));
+  }
+
+
+  // match a single token by its type. Tokens don't produce nodes
+  struct tok_parser : parser {
+    uint8_t type;
+    inline explicit tok_parser(uint8_t t) : type(t) {}
+    inline bool operator()(pstate &s, node_buf &) const {
+      if (s.kind() != type) return false;
+      s++;
+      return true;
+    }
+  };
+
+  inline auto tok(uint8_t type) { return tok_parser(type); }
+
+
+  // every parser in order, or nothing at all
+  template <typename... Ps>
+  struct seq_parser : parser {
+    std::tuple<Ps...> ps;
+    inline explicit seq_parser(Ps... p) : ps(std::move(p)...) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      pstate start = s;
+      size_t mark = out.size();
+      bool ok = std::apply(
+          [&](const auto &... p) { return (... && p(s, out)); }, ps);
+      if (!ok) {
+        s = start;
+        out.truncate(mark);
+      }
+      return ok;
+    }
+  };
+
+  template <typename... Ps>
+  inline auto sequence(Ps... ps) {
+    return seq_parser<Ps...>(std::move(ps)...);
+  }
+
+
+  // the first parser that succeeds. Failures already restored the state
+  template <typename... Ps>
+  struct alt_parser : parser {
+    std::tuple<Ps...> ps;
+    inline explicit alt_parser(Ps... p) : ps(std::move(p)...) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      return std::apply(
+          [&](const auto &... p) { return (... || p(s, out)); }, ps);
+    }
+  };
+
+  template <typename... Ps>
+  inline auto options(Ps... ps) {
+    return alt_parser<Ps...>(std::move(ps)...);
+  }
+
+
+  // zero or one. Never fails
+  template <typename P>
+  struct opt_parser : parser {
+    P p;
+    inline explicit opt_parser(P p) : p(std::move(p)) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      p(s, out);
+      return true;
+    }
+  };
+
+  template <typename P>
+  inline auto opt(P p) {
+    return opt_parser<P>(std::move(p));
+  }
+
+
+  // zero or more. Stops early if the parser succeeds without consuming
+  template <typename P>
+  struct many_parser : parser {
+    P p;
+    inline explicit many_parser(P p) : p(std::move(p)) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      while (true) {
+        int at = s.index();
+        if (!p(s, out) || s.index() == at) break;
+      }
+      return true;
+    }
+  };
+
+  template <typename P>
+  inline auto many(P p) {
+    return many_parser<P>(std::move(p));
+  }
+
+
+  /**
+   * a `sep` separated list of `p` that ends just before a `close` token,
+   * which it doesn't consume. The list may be empty and may have a trailing
+   * separator. Any other token after an item also ends the list, but a `p`
+   * that fails where an item is expected fails the whole list
+   */
+  template <typename P>
+  struct list_parser : parser {
+    P p;
+    uint8_t sep, close;
+    inline list_parser(P p, uint8_t sep, uint8_t close)
+        : p(std::move(p)), sep(sep), close(close) {}
+    inline bool operator()(pstate &s, node_buf &out) const {
+      pstate start = s;
+      size_t mark = out.size();
+      while (s.kind() != close) {
+        if (!p(s, out)) {
+          s = start;
+          out.truncate(mark);
+          return false;
+        }
+        if (s.kind() != sep) break;
+        s++;
+      }
+      return true;
+    }
+  };
+
+  template <typename P>
+  inline auto list(P p, uint8_t sep, uint8_t close) {
+    return list_parser<P>(std::move(p), sep, close);
+  }
+
+
+  template <typename L, typename R,
+            typename = std::enable_if_t<is_parser<L> && is_parser<R>>>
+  inline auto operator&(L l, R r) {
+    return sequence(std::move(l), std::move(r));
+  }
+
+  template <typename L, typename R,
+            typename = std::enable_if_t<is_parser<L> && is_parser<R>>>
+  inline auto operator|(L l, R r) {
+    return options(std::move(l), std::move(r));
+  }
+
+
+  /**
+   * run a combined parser from a state, turning the result back into a
+   * presult for code that still speaks in those
+   */
+  template <typename P>
+  inline presult run(const P &p, pstate s) {
+    node_buf buf;
+    pstate end = s;
+    if (!p(end, buf)) return pfail(s);
+    presult r;
+    r.vals = buf.to_vector();
+    r.state = end;
+    return r;
+  }
+
+}  // namespace helion::pcomb
+
+#endif
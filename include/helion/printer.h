@@ -0,0 +1,49 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_PRINTER_H__
+#define __HELION_PRINTER_H__
+
+#include <helion/ast.h>
+#include <stdint.h>
+#include "llvm/Support/raw_ostream.h"
+
+namespace helion {
+
+  namespace ast {
+
+    enum class print_format : uint8_t {
+      // helion syntax, which is what str() returns
+      source,
+      // (kind :field value ...), with lists as (a b c) and missing nodes as
+      // nil
+      sexpr,
+      // {"kind": "...", "field": value, ...}, with missing nodes as null
+      json,
+    };
+
+    /**
+     * write a tree to a stream as it's walked, without building any strings
+     * on the way, so printing is linear in the size of the output. Give it
+     * a buffered stream (llvm::outs(), a raw_fd_ostream, ...) for large
+     * modules. `depth` is how far the source format is indented to start
+     * with.
+     *
+     * Def bodies the parser skipped are left as they are, and printed as
+     * `...` in source, or with `elided` set instead of their stmts
+     */
+    void print(llvm::raw_ostream &, node *,
+               print_format format = print_format::source, int depth = 0);
+    void print(llvm::raw_ostream &, module &,
+               print_format format = print_format::source);
+
+    // the name of a node kind, as used by the sexpr and json formats
+    const char *kind_name(node_kind);
+
+  }  // namespace ast
+
+}  // namespace helion
+
+#endif
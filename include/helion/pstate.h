@@ -6,10 +6,14 @@
 #ifndef __PSTATE_H__
 #define __PSTATE_H__
 
+#include <helion/atom.h>
 #include <helion/core.h>
 #include <helion/tokenizer.h>
 #include <helion/util.h>
 #include <helion/ast.h>
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 
@@ -21,85 +25,127 @@ namespace helion {
     class func;
   };  // namespace ast
 
+  class scope;
+
+  /**
+   * what parsing did to a scope while the trace was set on it: the names
+   * looked up in or through it, the variables bound in it, and the scopes
+   * spawned from it
+   */
+  struct scope_trace {
+    std::vector<atom> lookups;
+    std::vector<std::shared_ptr<ast::var_decl>> binds;
+    std::vector<scope *> spawned;
+  };
+
   class scope {
    public:
     bool global = false;
     // a scope should know about the function it is based around
     std::shared_ptr<ast::func> fn;
+    // if set, this scope records what is done to it
+    scope_trace *trace = nullptr;
 
     inline scope() { m_parent = nullptr; }
     inline scope *spawn() {
       auto ns = std::make_unique<scope>();
       ns->m_parent = this;
+      ns->m_root = root();
       ns->fn = fn;
       scope *ptr = ns.get();
       children.push_back(std::move(ns));
+      if (trace != nullptr) trace->spawned.push_back(ptr);
       return ptr;
     }
 
-    inline std::shared_ptr<ast::var_decl> find(std::string &name) {
+    inline std::shared_ptr<ast::var_decl> find(atom name,
+                                               int before = INT_MAX) {
+      if (trace != nullptr) trace->lookups.push_back(name);
       // do a tree walking search, as variables can only be found in the current
       // scope and any scopes above it.
-      if (m_vars.count(name) != 0) {
-        return m_vars.at(name);
+      auto it = m_vars.find(name);
+      if (it != m_vars.end()) {
+        // the newest declaration of the name that isn't hidden. A lazily
+        // parsed body has to find one that was shadowed after it was
+        // skipped, just as it would have if it were parsed right away
+        auto &decls = it->second;
+        for (auto d = decls.rbegin(); d != decls.rend(); ++d)
+          if ((*d)->ind < before) return *d;
       }
       if (m_parent != nullptr) {
-        return m_parent->find(name);
+        return m_parent->find(name, std::min(before, m_horizon));
       }
 
       // not found
       return nullptr;
     }
 
-    inline void bind(std::string name, std::shared_ptr<ast::var_decl> &node) {
+    /**
+     * hide declarations numbered `ind` and up in the scopes above this one.
+     * A def body that is parsed lazily uses this to see its enclosing scopes
+     * as they were when the parser skipped over it
+     */
+    inline void hide_from(int ind) { m_horizon = ind; }
+
+    /**
+     * the ind for a new declaration, and the number for a new inferred type
+     * parameter. Both count up from 0 in each module's root scope, so files
+     * parsed on several threads are numbered the same way every run
+     */
+    inline int take_decl_index(void) { return root()->m_decls++; }
+    // the ind the next declaration will get
+    inline int next_decl_index(void) { return root()->m_decls; }
+    inline int take_type_num(void) { return root()->m_types++; }
+
+    inline void bind(atom name, std::shared_ptr<ast::var_decl> &node) {
       // very simple...
-      m_vars[name] = node;
+      m_vars[name].push_back(node);
+      if (trace != nullptr) trace->binds.push_back(node);
     }
 
-
-    inline text str(int depth = 0) {
-      text indent = "";
-      text ic = "  ";
-      for (int i = 0; i < depth; i++) indent += ic;
-
-      text s;
-
-      s += "{";
-      s += "\"vars\": [";
-      {
-        size_t i = 0;
-        for (auto &v : m_vars) {
-          i++;
-          s += "\"";
-          s += v.first;
-          s += "\"";
-          if (i < m_vars.size()) s += ", ";
-        }
-      }
-      s += "]";
-
-
-      if (children.size() > 0) {
-        s += ", \"children\": [";
-        size_t i = 0;
-        for (auto &c : children) {
-          i++;
-          s += c->str(depth + 1);
-          if (i < children.size()) {
-            s += ", ";
-          };
-        }
-        s += "]";
+    // forget every variable bound in this scope
+    inline void unbind_all(void) { m_vars.clear(); }
+
+    /**
+     * give up ownership of the scopes spawned from this one that `pick`
+     * returns true for, keeping the rest in order
+     */
+    template <typename Fn>
+    std::vector<std::unique_ptr<scope>> take_children(Fn pick) {
+      std::vector<std::unique_ptr<scope>> taken;
+      size_t kept = 0;
+      for (auto &c : children) {
+        if (pick(c.get()))
+          taken.push_back(std::move(c));
+        else
+          children[kept++] = std::move(c);
       }
-      s += "}";
-      return s;
+      children.resize(kept);
+      return taken;
     }
 
 
+    // the names bound in this scope and the ones under it, as json.
+    // Defined in printer.cpp
+    void print(llvm::raw_ostream &);
+    text str(int depth = 0);
+
+
    protected:
     scope *m_parent = nullptr;
+    // the scope of the module this one is in, or nullptr if it's that scope
+    scope *m_root = nullptr;
+    int m_horizon = INT_MAX;
+    // only used in the root scope. A lazily parsed body can number its
+    // declarations while another body of the module is being parsed
+    std::atomic<int> m_decls{0};
+    std::atomic<int> m_types{0};
+
+    inline scope *root(void) { return m_root != nullptr ? m_root : this; }
     std::vector<std::unique_ptr<scope>> children;
-    std::unordered_map<std::string, std::shared_ptr<ast::var_decl>> m_vars;
+    // every declaration bound to each name, in the order they were bound
+    std::unordered_map<atom, std::vector<std::shared_ptr<ast::var_decl>>>
+        m_vars;
   };
 
 
@@ -122,21 +168,45 @@ namespace helion {
 
     inline text line(long ln) { return tokn->get_line(ln); }
 
+    inline int index(void) { return ind; }
+    inline tokenizer *tokens(void) { return tokn.get(); }
+    // the state at another token index of the same stream
+    inline pstate at(int i) { return pstate(tokn, i); }
+
     inline text path(void) { return tokn->get_path(); }
 
     inline token first(void) {
-      static auto eof = token(tok_eof, "", nullptr, 0, 0);
       if (tokn != nullptr) {
         return tokn->get(ind);
       } else {
-        return eof;
+        return token();
       }
     }
+
+    // the type of the first token, which is all most lookahead needs
+    inline uint8_t kind(void) {
+      return tokn != nullptr ? tokn->kind(ind) : (uint8_t)tok_eof;
+    }
+
+    // the decoded text of a token
+    inline text val(const token &t) { return tokn->value(t); }
+    inline text val(void) { return val(first()); }
+
+    // the interned name of the first token, if it is an identifier
+    inline atom sym(void) { return tokn != nullptr ? tokn->atom_at(ind) : atom(); }
+
+    // the raw bytes of a token, for cheap comparisons
+    inline std::string_view bytes(const token &t) { return tokn->bytes(t); }
+    inline std::string_view bytes(void) { return bytes(first()); }
+
+    inline position position_of(const token &t) {
+      return tokn != nullptr ? tokn->position_of(t) : position();
+    }
     inline pstate next(void) {
       auto p = pstate(tokn, ind + 1);
       return p;
     }
-    inline bool done(void) { return first().type == tok_eof; }
+    inline bool done(void) { return kind() == tok_eof; }
 
     inline operator bool(void) { return !done(); }
     inline operator token(void) { return first(); }
@@ -0,0 +1,63 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_RESOLVE_H__
+#define __HELION_RESOLVE_H__
+
+#include <helion/ast.h>
+#include <memory>
+#include <vector>
+
+namespace helion {
+
+  namespace ast {
+
+    /**
+     * lexical addressing. Every function gets a frame, an array with a slot
+     * for each of its arguments and local variables, numbered in the order
+     * they're declared. Every var that points to a local declaration gets
+     * the (depth, slot) of that declaration relative to the function it's
+     * used in, which is enough to find it by walking `depth` frames up and
+     * indexing into the frame instead of looking the name up in every scope
+     * on the way. Codegen of locals is still a stub, so for now only the
+     * sexpr and json printers show them.
+     *
+     * Globals (top level `let`s, `let global`, and names with no declaration)
+     * keep a depth and slot of -1 and are still looked up by name. Locals in
+     * top level statements live in the frame of the module's entry function.
+     *
+     * The parser resolves the modules it returns, and the bodies of lazily
+     * parsed defs when they're parsed, so this only has to be called on
+     * trees that are built or changed some other way. Resolving is
+     * idempotent
+     */
+    void resolve(module &);
+
+    /**
+     * resolve top level statements that were added to a module's entry after
+     * the rest of it was resolved. Their locals get new slots at the end of
+     * the entry's frame, so the slots of the statements already there stay
+     * where they are
+     */
+    void resolve(module &, const std::vector<std::shared_ptr<node>> &);
+
+    /**
+     * resolve a module after an edit replaced some of its top level forms
+     * with `changed`. The entry's frame is laid out again from the
+     * statements it has now, so the slots of removed ones don't pile up.
+     * Of the defs and types, only the changed ones are walked, as nothing
+     * in them points into the entry's frame
+     */
+    void resolve_edit(module &, const std::vector<std::shared_ptr<node>> &);
+
+    // resolve the statements of a function that was resolved before its
+    // body was parsed
+    void resolve_body(func &);
+
+  }  // namespace ast
+
+}  // namespace helion
+
+#endif
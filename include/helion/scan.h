@@ -0,0 +1,45 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_SCAN_H__
+#define __HELION_SCAN_H__
+
+#include <stddef.h>
+
+namespace helion {
+
+  /**
+   * vectorized scanners for the hot loops of the tokenizer. Each function
+   * works on the byte range [p, end) and returns a pointer to the first byte
+   * that stops the scan, or `end` if none does.
+   *
+   * The implementation (AVX2, SSE2 or plain scalar code) is picked once at
+   * startup based on what the CPU supports.
+   */
+  namespace scan {
+
+    // skip over a run of ' ' and '\t'
+    const char *skip_spaces(const char *p, const char *end);
+
+    // find the next '\n'
+    const char *find_newline(const char *p, const char *end);
+
+    // skip over a run of the common identifier bytes, [A-Za-z0-9_]
+    const char *skip_word(const char *p, const char *end);
+
+    // how many '\n' bytes are in the range
+    size_t count_newlines(const char *p, const char *end);
+
+    // how many utf8 code points start in the range
+    size_t count_runes(const char *p, const char *end);
+
+    // the name of the implementation in use, ie: "avx2"
+    const char *impl_name(void);
+
+  }  // namespace scan
+
+}  // namespace helion
+
+#endif
@@ -0,0 +1,175 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_SOURCE_H__
+#define __HELION_SOURCE_H__
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace helion {
+
+
+  /**
+   * a source_buffer is an immutable view of the raw UTF-8 bytes of a source
+   * file. When loaded from disk, the file is mmap'd directly so the tokenizer
+   * can work on the bytes without copying or widening them. The bytes are
+   * *not* null terminated, so always bound reads by size()
+   */
+  class source_buffer {
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+
+    // non-null when the data is an mmap'd region that needs to be unmapped
+    void *m_map = nullptr;
+    // backing storage when the buffer was built from memory, not a file
+    std::string m_owned;
+
+   public:
+    source_buffer() = default;
+    source_buffer(const source_buffer &) = delete;
+    source_buffer &operator=(const source_buffer &) = delete;
+    ~source_buffer();
+
+    /**
+     * map a file into memory. Returns nullptr if the file could not be
+     * opened or mapped
+     */
+    static std::shared_ptr<source_buffer> map_file(const char *path);
+
+    // copy a utf8 string into a newly owned buffer
+    static std::shared_ptr<source_buffer> from_string(std::string);
+
+    inline const char *data(void) const { return m_data; }
+    inline size_t size(void) const { return m_size; }
+
+    inline char operator[](size_t i) const { return m_data[i]; }
+  };
+
+
+
+  /**
+   * a source_loc names a single byte in any file loaded into the
+   * source_manager. Each file is given its own contiguous range of locations,
+   * so a location is just the file's base plus a byte offset and fits in 32
+   * bits. Zero is never a valid location
+   */
+  using source_loc = uint32_t;
+
+
+  // a line and column pair, both starting at zero. Columns count code points
+  struct position {
+    uint32_t line = 0;
+    uint32_t col = 0;
+  };
+
+
+  /**
+   * a source_file is a buffer that has been registered with the
+   * source_manager. It knows its range of locations and lazily builds an
+   * index of where each line starts, so turning a location back into a line
+   * and column is a binary search rather than a rescan of the file
+   */
+  class source_file {
+    friend class source_manager;
+
+    std::string m_path;
+    std::shared_ptr<source_buffer> m_buffer;
+    source_loc m_base = 0;
+
+    // byte offset of the start of every line, built on first use
+    std::vector<uint32_t> m_lines;
+    std::once_flag m_lines_built;
+    const std::vector<uint32_t> &lines(void);
+
+   public:
+    inline const std::string &path(void) const { return m_path; }
+    inline const std::shared_ptr<source_buffer> &buffer(void) const {
+      return m_buffer;
+    }
+
+    inline source_loc base(void) const { return m_base; }
+    inline source_loc loc(size_t offset) const { return m_base + offset; }
+    inline size_t offset(source_loc l) const { return l - m_base; }
+    // does this file own the location? The end of file counts as a location
+    inline bool contains(source_loc l) const {
+      return l >= m_base && l - m_base <= m_buffer->size();
+    }
+
+    size_t line_count(void);
+    // the zero based line and column of a byte offset in the file
+    position position_of(size_t offset);
+    // the text of a line, without its newline
+    std::string_view line_text(size_t line);
+  };
+
+
+  /**
+   * the source_manager owns every file the front end has loaded, and hands
+   * out their locations. Files added with add() or load() are never
+   * unloaded, so their source_file pointers and locations stay valid for the
+   * life of the process.
+   *
+   * Something that goes through many versions of a file (an editor session)
+   * reserves a range of locations instead, and swaps its versions in and
+   * out of it with adopt() and remove(), so it doesn't use up the location
+   * space one version at a time.
+   */
+  class source_manager {
+    struct range {
+      uint64_t base, span;
+    };
+
+    std::mutex lock;
+    // sorted by base
+    std::vector<std::unique_ptr<source_file>> files;
+    std::vector<range> reserved;
+    // reserved ranges that were released, to be reserved again
+    std::vector<range> free_ranges;
+    // the next unused location. Zero is kept as the invalid location
+    uint64_t next_loc = 1;
+
+    uint64_t take(uint64_t span);
+
+   public:
+    // the process wide manager
+    static source_manager &global(void);
+
+    // register a buffer under a path
+    source_file *add(std::shared_ptr<source_buffer>, std::string path);
+    // map a file from disk and register it, nullptr if it can't be read
+    source_file *load(const std::string &path);
+
+    // set aside `span` locations, which nothing is given until the range is
+    // released
+    source_loc reserve(size_t span);
+    // give a reserved range back. Nothing may still be loaded in it
+    void release(source_loc base);
+
+    /**
+     * a file at `base`, inside a reserved range, that isn't registered yet.
+     * Its own locations work (enough to tokenize and parse it), but file_of
+     * won't find it until it's adopted
+     */
+    static std::unique_ptr<source_file> make(std::shared_ptr<source_buffer>,
+                                             std::string path,
+                                             source_loc base);
+    source_file *adopt(std::unique_ptr<source_file>);
+    // unload an adopted file. Its locations are no longer valid
+    void remove(source_file *);
+
+    // the file a location is in, or nullptr
+    source_file *file_of(source_loc);
+    // the file, line and column of a location
+    position position_of(source_loc, source_file ** = nullptr);
+  };
+
+}  // namespace helion
+
+#endif
@@ -3,99 +3,233 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <iterator>
+#include <ostream>
 #include <string>
+#include <string_view>
 
 namespace helion {
 
 	using rune = uint32_t;
 
+
+	namespace utf8 {
+
+		/**
+		 * decode a single code point from a utf8 byte sequence of at most
+		 * `avail` bytes, storing how many bytes were consumed in `width`.
+		 * Malformed or truncated sequences decode to U+FFFD and consume a
+		 * single byte so the caller always makes progress
+		 */
+		inline rune decode(const char *s, size_t avail, size_t &width) {
+			auto b = (const unsigned char *)s;
+			width = 1;
+			if (b[0] < 0x80) return b[0];
+
+			size_t len;
+			rune r;
+			if ((b[0] & 0xE0) == 0xC0) {
+				len = 2;
+				r = b[0] & 0x1F;
+			} else if ((b[0] & 0xF0) == 0xE0) {
+				len = 3;
+				r = b[0] & 0x0F;
+			} else if ((b[0] & 0xF8) == 0xF0) {
+				len = 4;
+				r = b[0] & 0x07;
+			} else {
+				return 0xFFFD;
+			}
+
+			if (len > avail) return 0xFFFD;
+			for (size_t i = 1; i < len; i++) {
+				if ((b[i] & 0xC0) != 0x80) return 0xFFFD;
+				r = (r << 6) | (b[i] & 0x3F);
+			}
+			width = len;
+			return r;
+		}
+
+		// the most bytes encode() writes for one code point
+		constexpr size_t max_width = 4;
+
+		// write the utf8 encoding of a code point to `out`, returning how many
+		// bytes it took
+		inline size_t encode(rune r, char *out) {
+			if (r < 0x80) {
+				out[0] = (char)r;
+				return 1;
+			} else if (r < 0x800) {
+				out[0] = (char)(0xC0 | (r >> 6));
+				out[1] = (char)(0x80 | (r & 0x3F));
+				return 2;
+			} else if (r < 0x10000) {
+				out[0] = (char)(0xE0 | (r >> 12));
+				out[1] = (char)(0x80 | ((r >> 6) & 0x3F));
+				out[2] = (char)(0x80 | (r & 0x3F));
+				return 3;
+			}
+			out[0] = (char)(0xF0 | (r >> 18));
+			out[1] = (char)(0x80 | ((r >> 12) & 0x3F));
+			out[2] = (char)(0x80 | ((r >> 6) & 0x3F));
+			out[3] = (char)(0x80 | (r & 0x3F));
+			return 4;
+		}
+
+		// append the utf8 encoding of a code point onto a byte string
+		inline void encode(rune r, std::string &out) {
+			char buf[max_width];
+			out.append(buf, encode(r, buf));
+		}
+	}  // namespace utf8
+
+
+	/**
+	 * a string of code points, stored as utf8. Strings of up to
+	 * inline_capacity bytes (most identifiers and operators) live inside the
+	 * object without a heap allocation, and the number of code points is kept
+	 * alongside the number of bytes so neither has to be counted.
+	 *
+	 * Anything that isn't valid utf8 is replaced with U+FFFD as it's added,
+	 * so the bytes can always be handed out as they are
+	 */
 	class text {
 		public:
+			static constexpr uint32_t inline_capacity = 23;
+
+			// walks the code points, decoding them as it goes
+			class const_iterator {
+				const char *m_pos = nullptr;
+				const char *m_end = nullptr;
+
+				public:
+					using iterator_category = std::forward_iterator_tag;
+					using value_type = rune;
+					using difference_type = ptrdiff_t;
+					using pointer = void;
+					using reference = rune;
+
+					const_iterator(void) = default;
+					inline const_iterator(const char *p, const char *e) : m_pos(p), m_end(e) {}
+
+					inline rune operator*(void) const {
+						if ((unsigned char)*m_pos < 0x80) return (unsigned char)*m_pos;
+						size_t width;
+						return utf8::decode(m_pos, m_end - m_pos, width);
+					}
+					inline const_iterator &operator++(void) {
+						size_t width = 1;
+						if ((unsigned char)*m_pos >= 0x80) utf8::decode(m_pos, m_end - m_pos, width);
+						m_pos += width;
+						return *this;
+					}
+					inline const_iterator operator++(int) {
+						const_iterator self = *this;
+						++*this;
+						return self;
+					}
+					inline bool operator==(const const_iterator &o) const { return m_pos == o.m_pos; }
+					inline bool operator!=(const const_iterator &o) const { return m_pos != o.m_pos; }
+			};
+
+			// the code points can't be changed in place
+			using iterator = const_iterator;
 
-		  // using container = std::u32string;
-		  using container = std::u32string;
+			typedef rune value_type;
+			typedef rune reference;
+			typedef rune const_reference;
 
 		protected:
 
 			friend std::hash<helion::text>;
 
-
-			void ingest_utf8(std::string const&);
+			// either m_inline or a heap buffer of m_cap + 1 bytes. Always null
+			// terminated
+			char *m_data = m_inline;
+			uint32_t m_size = 0;
+			uint32_t m_length = 0;
+			uint32_t m_cap = inline_capacity;
+			char m_inline[inline_capacity + 1] = {};
+
+			void reserve_bytes(size_t);
+			bool aliases(const char *) const;
+			// add bytes that are already known to be valid utf8
+			void append_valid(const char *, size_t, uint32_t runes);
+			void append_utf8(const char *, size_t);
+			void append_rune(rune);
 
 		public:
-			container buf;
-
-			typedef container::iterator iterator;
-			typedef container::const_iterator const_iterator;
-
-			typedef rune value_type;
-			typedef rune& reference;
-			typedef const rune& const_reference;
 
 			text(void);
 			text(char*);
 			text(const char*);
 			text(const char32_t*);
+			// decode `len` bytes of utf8 directly, without a temporary std::string
+			text(const char*, size_t);
 			text(std::string const&);
 			text(std::u32string const&);
 			text(const helion::text&);
+			text(helion::text&&) noexcept;
 
 			~text(void);
 
 
-			iterator begin(void);
-			iterator end(void);
+			iterator begin(void) const;
+			iterator end(void) const;
 
 			const_iterator cbegin(void) const;
 			const_iterator cend(void) const;
 
-			uint32_t size(void);
-			uint32_t length(void);
-			uint32_t max_size(void);
+			// the length in code points
+			uint32_t size(void) const;
+			uint32_t length(void) const;
+			uint32_t max_size(void) const;
 
 			void resize(uint32_t, rune c = 0);
 
-			uint32_t capacity(void);
+			// how many bytes fit without reallocating
+			uint32_t capacity(void) const;
 
 			void clear(void);
 
-			bool empty(void);
+			bool empty(void) const;
+
+			// the utf8 bytes
+			inline const char *data(void) const { return m_data; }
+			inline const char *c_str(void) const { return m_data; }
+			inline uint32_t bytes(void) const { return m_size; }
+			inline std::string_view view(void) const { return std::string_view(m_data, m_size); }
 
 
 			text& operator+=(const text&);
 			text& operator+=(const char *);
 			text& operator+=(std::string const&);
+			text& operator+=(std::string_view);
 			text& operator+=(char);
 			text& operator+=(int);
 			text& operator+=(rune);
 
 			text& operator=(const text&);
+			text& operator=(text&&) noexcept;
 
 			bool operator==(const text &other) const;
 
-			bool operator==(const text&);
-
 
 			operator std::string() const;
 			operator std::u32string() const;
 
+			// the code point at an index. Only constant time for ascii text
 			rune operator[](size_t) const;
-			rune operator[](size_t);
 
 
-			void push_back(rune&);
-			void push_back(rune&&);
+			void push_back(rune);
 	};
 
 
-	inline std::ostream& operator<<(std::ostream& os, text& r) {
-		std::string s = r;
-		return os << s;
-	}
-
 	inline std::ostream& operator<<(std::ostream& os, const text& r) {
-		std::string s = r;
-		return os << s;
+		return os.write(r.data(), r.bytes());
 	}
 
 };
@@ -105,7 +239,6 @@ template <>
 struct std::hash<helion::text> {
 	std::size_t operator()(const helion::text& k) const
 	{
-		std::hash<helion::text::container> hash_func;
-		return hash_func(k.buf);
+		return std::hash<std::string_view>()(k.view());
 	}
 };
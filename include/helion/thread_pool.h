@@ -0,0 +1,75 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#pragma once
+
+#ifndef __HELION_THREAD_POOL_H__
+#define __HELION_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace helion {
+
+
+  /**
+   * a fixed set of worker threads that run jobs in the order they were
+   * submitted. Used by the front end to lex and parse independent pieces of
+   * work on all cores. Jobs must not block waiting on other jobs in the same
+   * pool, as there is no work stealing
+   */
+  class thread_pool {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void work(void);
+
+   public:
+    // a pool of `n` workers, or one per hardware thread if `n` is zero
+    explicit thread_pool(size_t n = 0);
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+    // finishes every job already submitted, then joins the workers
+    ~thread_pool();
+
+    inline size_t size(void) const { return workers.size(); }
+
+    /**
+     * queue a function to be run on a worker, returning a future for its
+     * result. Exceptions thrown by the job are rethrown from future::get
+     */
+    template <typename Fn>
+    auto submit(Fn &&fn) -> std::future<decltype(fn())> {
+      using result = decltype(fn());
+      auto task =
+          std::make_shared<std::packaged_task<result()>>(std::forward<Fn>(fn));
+      auto fut = task->get_future();
+      {
+        std::unique_lock<std::mutex> l(lock);
+        jobs.emplace_back([task] { (*task)(); });
+      }
+      wake.notify_one();
+      return fut;
+    }
+
+    // the process wide pool, created on first use
+    static thread_pool &global(void);
+
+    // whether the calling thread is a worker of any pool. Work that would
+    // fan out onto a pool runs inline instead when this is true, since a job
+    // waiting on jobs queued behind it could deadlock
+    static bool on_worker(void);
+  };
+
+}  // namespace helion
+
+#endif
@@ -6,9 +6,16 @@
 #ifndef __TOKENIZER_H__
 #define __TOKENIZER_H__
 
+#include <helion/atom.h>
+#include <helion/source.h>
 #include <helion/text.h>
+#include <helion/thread_pool.h>
+#include <iostream>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 
@@ -33,43 +40,60 @@ namespace helion {
   };
 
   // a token represents a single atomic lexeme that gets parsed
-  // out of a string with cedar::parser::lexer
+  // out of a string with cedar::parser::lexer. Tokens are small and trivially
+  // copyable: they don't own their text, they only refer to a span of bytes
+  // in the tokenizer's source. Use tokenizer::value to decode it.
   class token {
    public:
-    std::shared_ptr<text> source;
-    ssize_t line;
-    ssize_t col;
-    int8_t type;
+    uint8_t type = tok_eof;
     bool space_before = false;
-    text val;
-    inline token() { source = nullptr; }
-    token(uint8_t, text, std::shared_ptr<text>, size_t line, size_t col);
+    // byte span of the lexeme in the source
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    // where the lexeme starts, resolved to a line/col by the source_manager
+    source_loc loc = 0;
   };
 
+  static_assert(sizeof(token) == 16, "tokens should stay packed");
+
   inline std::ostream& operator<<(std::ostream& os, const token& tok) {
     static const char* tok_names[] = {
 #define TOKEN(name, code, s) s,
 #include "tokens.inc"
 #undef TOKEN
     };
-    text buf;
-    buf += tok_names[tok.type];
-    buf += "(\"";
-    buf += tok.val;
-    buf += "\", ";
-    buf += std::to_string(tok.line);
-    buf += ", ";
-    buf += std::to_string(tok.col);
-    buf += ")";
-    os << buf;
+    os << tok_names[tok.type] << "(" << tok.offset << ", " << tok.length
+       << ")";
     return os;
   }
 
+  /**
+   * a parse rule that is known to fail at a token index. The parser's rules
+   * take a scope, so an entry only applies when the rule is run again with
+   * the scope it was recorded in
+   */
+  struct memo_entry {
+    const void *scope = nullptr;
+    // the token index the failure was reported at
+    uint32_t end = 0;
+  };
+
+  /**
+   * how an edited source's token stream lines up with the stream of the
+   * source before the edit. Tokens [0, prefix) are the same in both, and if
+   * lexing synced back up after the edit, the old tokens from suffix_old on
+   * are the new ones from suffix_new on
+   */
+  struct token_splice {
+    size_t prefix = 0;
+    size_t suffix_old = -1;
+    size_t suffix_new = -1;
+  };
+
   class tokenizer {
    private:
+    // byte offset of the next rune in the utf8 source
     size_t index = 0;
-    size_t line = 0;
-    size_t column = 0;
 
     ssize_t last_emit_ended = -1;
 
@@ -81,16 +105,40 @@ namespace helion {
 
 
     text path;
-    std::shared_ptr<text> source;
-    std::shared_ptr<std::vector<token>> tokens;
+    source_file *file = nullptr;
+    std::shared_ptr<source_buffer> source;
+    // set if this tokenizer registered `file` itself, which unloads it once
+    // the tokenizer is gone
+    std::shared_ptr<source_file> scoped;
+
+    // every token lexed so far, stored struct-of-arrays. The parser mostly
+    // looks at kinds, so keeping them dense keeps lookahead in cache. When
+    // streaming, the arrays only hold the tokens from `base` on
+    size_t base = 0;
+    std::vector<uint8_t> kinds;
+    std::vector<bool> spaced;
+    std::vector<uint32_t> lengths;
+    std::vector<source_loc> locs;
+    // the interned id of identifier tokens, zero for everything else
+    std::vector<uint32_t> atoms;
+
+    // set until the first token is asked for, if the source should be
+    // lexed with lex_parallel then
+    bool parallel = false;
+
     rune next();
     rune peek();
 
+    // lex at least one more token. Returns false at the end of the source
+    bool lex_more();
+
     /**
-     * emit will create a token with line number information and everything
-     * according to the current state in the tokenizer
+     * emit will create a token according to the current state in the
+     * tokenizer. The token's text is the bytes [start, end) of the source,
+     * where end defaults to the index
      */
-    token emit(uint8_t, text);
+    token emit(uint8_t, size_t start);
+    token emit(uint8_t, size_t start, size_t end);
 
     void panic(std::string msg);
 
@@ -100,14 +148,109 @@ namespace helion {
      */
     token lex();
 
+    /**
+     * lex until the index reaches `stop` or the end of the file. Returns
+     * false if a token failed to lex, leaving the tokenizer just after the
+     * last good token so the error is raised again when lexed lazily
+     */
+    bool lex_until(size_t stop);
+
+    // the first token lexed from a byte offset where a previous token ended,
+    // or -1 if no token of this tokenizer starts lexing there
+    size_t resume_point(size_t at);
+
+    // append another tokenizer's tokens from `from` on, and take over its
+    // lexing state
+    void adopt(tokenizer& chunk, size_t from);
+
+    // a tokenizer for one chunk of a larger source, starting at `start`
+    tokenizer(source_file*, size_t start);
+    explicit tokenizer(std::shared_ptr<source_file> scoped);
+
+    // where lexing stopped after a token
+    size_t end_of(size_t);
+
    public:
     bool done = false;
     text get_line(long);
     inline text get_path(void) { return path; }
+    inline source_file* get_file(void) { return file; }
 
+    /**
+     * the parser's packrat memo, keyed by (rule << 32 | token index). It lives
+     * here so every pstate over this token stream shares it. Turning it off
+     * makes the parser backtrack naively, which is only useful for debugging
+     */
+    bool memoize = true;
+    std::unordered_map<uint64_t, memo_entry> memo;
+
+    // have the parser skip the bodies of defs, to be parsed when first needed
+    // (see ast::func::parse_body)
+    bool lazy_bodies = false;
+    // held while a skipped body is parsed, as parsing lexes ahead and writes
+    // to the memo
+    std::mutex parse_lock;
+
+    // the furthest token index anything has been asked about. The
+    // incremental parser uses it to tell which tokens a parse looked at
+    size_t furthest = 0;
+
+    // these register the source with the global source_manager for as long
+    // as the tokenizer is alive. Its locations aren't valid after that
     explicit tokenizer(text, text);
+    explicit tokenizer(std::shared_ptr<source_buffer>, text);
+    explicit tokenizer(source_file*);
 
+    /**
+     * lex `edited`, which is the source of `old` with the `removed` bytes at
+     * `offset` replaced by `inserted` bytes. Tokens that can't have changed
+     * are copied from `old` instead of lexed, so only the edit and the tokens
+     * touching it are lexed again. `splice` is set to what was copied
+     */
+    tokenizer(tokenizer& old, source_file* edited, size_t offset,
+              size_t removed, size_t inserted, token_splice& splice);
+
+    // sources at least this big are lexed up front with lex_parallel, unless
+    // the tokenizer is made on a pool worker (ie: while parsing many files)
+    // or is streaming
+    static constexpr size_t parallel_threshold = 4 << 20;
+
+    /**
+     * in streaming mode, the parser calls commit() at points it will never
+     * backtrack past, and the tokens before them are released. The tokens
+     * held are then only those of the top level form being parsed, not the
+     * whole file. Set it before the first token is asked for
+     */
+    bool streaming = false;
+
+    /**
+     * nothing will ask about the tokens before `index` again, so a streaming
+     * tokenizer can let them go. Asking about one anyway is a logic_error
+     */
+    void commit(size_t index);
+
+    /**
+     * lex the whole source by splitting it into chunks at the start of lines
+     * and lexing each chunk on the pool. Chunks are stitched back together
+     * where the token streams agree, and relexed serially where they don't,
+     * so the result is exactly what lexing the file front to back gives
+     */
+    void lex_parallel(thread_pool& pool);
+
+    // tokens are returned by value, as they are only 16 bytes and a reference
+    // into the token arrays would be invalidated by lexing further ahead
     token get(size_t);
+    // the type of the token at an index, without building the whole token
+    uint8_t kind(size_t);
+    // the interned name of the identifier at an index, or the empty atom
+    helion::atom atom_at(size_t);
+
+    // the decoded text of a token. String literals have their escapes
+    // resolved here
+    text value(const token&);
+    // the raw utf8 bytes of a token, which is cheap to compare against
+    std::string_view bytes(const token&);
+    position position_of(const token&);
   };
 
 }  // namespace helion
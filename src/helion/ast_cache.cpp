@@ -0,0 +1,448 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/ast_cache.h>
+#include <helion/parser.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace helion;
+using namespace helion::ast;
+
+
+namespace {
+
+  /**
+   * the layout of an entry: this header, then each array in the order of
+   * the counts, each starting on an 8 byte boundary. Names and texts share
+   * one table of strings, the texts first, given as the offsets of every
+   * string's start and of the end of the last one, then the utf8 bytes
+   */
+  struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t nodes;
+    uint32_t children;
+    uint32_t numbers;
+    uint32_t texts;
+    uint32_t atoms;
+    uint32_t typedefs;
+    uint32_t defs;
+    uint32_t string_bytes;
+    node_id entry;
+    uint32_t pad = 0;
+  };
+
+  static_assert(sizeof(cache_header) == 64, "the cache header is on disk");
+
+  const char cache_magic[4] = {'h', 'a', 's', 't'};
+
+
+  uint64_t content_hash(const char *p, size_t size) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+    auto mix = [&](uint64_t w) {
+      h ^= w;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    };
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      uint64_t w;
+      memcpy(&w, p + i, 8);
+      mix(w);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, size - i);
+    mix(tail);
+    return h;
+  }
+
+  uint64_t content_hash(source_file *file) {
+    auto &buf = *file->buffer();
+    return content_hash(buf.data(), buf.size());
+  }
+
+
+  // the kinds whose data is an atom
+  bool data_is_atom(node_kind k) {
+    switch (k) {
+      case node_kind::binary_op:
+      case node_kind::dot:
+      case node_kind::type_node:
+      case node_kind::var_decl:
+      case node_kind::var:
+      case node_kind::def:
+      case node_kind::field:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // the fewest children a node of a kind can have
+  uint64_t min_children(const flat_node &n) {
+    switch (n.kind) {
+      case node_kind::binary_op:
+      case node_kind::var_decl:
+      case node_kind::typeassert:
+        return 2;
+      case node_kind::dot:
+      case node_kind::subscript:
+      case node_kind::call:
+      case node_kind::prototype:
+      case node_kind::def:
+      case node_kind::if_condition:
+      case node_kind::field:
+        return 1;
+      case node_kind::func:
+        return 1 + (uint64_t)n.aux;
+      case node_kind::typedef_node:
+        return 2 + (uint64_t)n.aux;
+      default:
+        return 0;
+    }
+  }
+
+
+  inline size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+
+  // bounds checked reads of the arrays after the header
+  class reader {
+    const char *m_at, *m_end;
+
+   public:
+    reader(const char *begin, const char *end) : m_at(begin), m_end(end) {}
+
+    template <typename T>
+    bool read(std::vector<T> &out, size_t count) {
+      size_t bytes = count * sizeof(T);
+      if ((size_t)(m_end - m_at) < bytes) return false;
+      out.resize(count);
+      memcpy(out.data(), m_at, bytes);
+      m_at += std::min(align8(bytes), (size_t)(m_end - m_at));
+      return true;
+    }
+  };
+
+
+  // would building the tree from this module stay in bounds?
+  bool valid(const flat_module &m, size_t atoms) {
+    size_t count = m.nodes.size();
+    auto ok_id = [&](node_id id) { return id == no_node || id < count; };
+
+    for (auto &n : m.nodes) {
+      if (n.kind > node_kind::field) return false;
+      if ((uint64_t)n.first + n.count > m.children.size()) return false;
+      if (n.count < min_children(n)) return false;
+      if (data_is_atom(n.kind) && n.data >= atoms) return false;
+      switch (n.kind) {
+        case node_kind::number:
+          if (n.data >= m.numbers.size()) return false;
+          break;
+        case node_kind::string:
+        case node_kind::keyword:
+          if (n.data >= m.texts.size()) return false;
+          break;
+        case node_kind::var:
+          if (!(n.flags & flat_global) && n.aux >= count) return false;
+          break;
+        default:
+          break;
+      }
+    }
+    for (auto id : m.children)
+      if (!ok_id(id)) return false;
+
+    // the tree has typed pointers in places, so those children have to be
+    // of the right kind
+    auto is = [&](node_id id, node_kind k) {
+      return id == no_node || m.nodes[id].kind == k;
+    };
+    for (auto &n : m.nodes) {
+      auto *c = m.children.data() + n.first;
+      auto all = [&](uint32_t from, uint32_t to, node_kind k) {
+        for (uint32_t i = from; i < to; i++)
+          if (!is(c[i], k)) return false;
+        return true;
+      };
+      bool ok = true;
+      switch (n.kind) {
+        case node_kind::type_node:
+          ok = all(0, n.count, node_kind::type_node);
+          break;
+        case node_kind::var_decl:
+        case node_kind::field:
+          ok = is(c[0], node_kind::type_node);
+          break;
+        case node_kind::var:
+          ok = (n.flags & flat_global) || is(n.aux, node_kind::var_decl);
+          break;
+        case node_kind::prototype:
+          ok = is(c[0], node_kind::type_node) &&
+               all(1, n.count, node_kind::var_decl);
+          break;
+        case node_kind::func:
+          ok = is(c[0], node_kind::prototype) &&
+               all(1 + n.aux, n.count, node_kind::var_decl);
+          break;
+        case node_kind::def:
+          ok = is(c[0], node_kind::func);
+          break;
+        case node_kind::if_node:
+          ok = all(0, n.count, node_kind::if_condition);
+          break;
+        case node_kind::typedef_node:
+          ok = all(0, 2, node_kind::type_node) &&
+               all(2, 2 + n.aux, node_kind::field) &&
+               all(2 + n.aux, n.count, node_kind::def);
+          break;
+        case node_kind::typeassert:
+          ok = is(c[1], node_kind::type_node);
+          break;
+        default:
+          break;
+      }
+      if (!ok) return false;
+    }
+
+    // the conditions of ifs and fields of typedefs are looked through
+    // rather than built, so they can't be missing
+    for (auto &n : m.nodes) {
+      if (n.kind != node_kind::if_node && n.kind != node_kind::typedef_node)
+        continue;
+      uint32_t from = n.kind == node_kind::if_node ? 0 : 2;
+      uint32_t to = n.kind == node_kind::if_node ? n.count : 2 + n.aux;
+      for (uint32_t i = from; i < to; i++)
+        if (m.children[n.first + i] == no_node) return false;
+    }
+
+    // and a node can't be its own descendant, or the tree would be a cycle
+    // of shared pointers. Checked with an iterative depth first search,
+    // where a node is on the stack while its descendants are walked
+    enum : uint8_t { unseen, walking, done };
+    std::vector<uint8_t> state(count, unseen);
+    std::vector<std::pair<node_id, uint32_t>> stack;
+    for (node_id root = 0; root < count; root++) {
+      if (state[root] != unseen) continue;
+      state[root] = walking;
+      stack.push_back({root, 0});
+      while (!stack.empty()) {
+        auto &[id, next] = stack.back();
+        auto &n = m.nodes[id];
+        // a var's declaration comes after its children
+        bool has_decl = n.kind == node_kind::var && !(n.flags & flat_global);
+        if (next == n.count + (has_decl ? 1 : 0)) {
+          state[id] = done;
+          stack.pop_back();
+          continue;
+        }
+        node_id c = next < n.count ? m.children[n.first + next] : n.aux;
+        next++;
+        if (c == no_node || state[c] == done) continue;
+        if (state[c] == walking) return false;
+        state[c] = walking;
+        stack.push_back({c, 0});
+      }
+    }
+
+    for (auto id : m.typedefs)
+      if (id >= count || m.nodes[id].kind != node_kind::typedef_node)
+        return false;
+    for (auto id : m.defs)
+      if (id >= count || m.nodes[id].kind != node_kind::def) return false;
+    if (m.entry != no_node) {
+      if (m.entry >= count || m.nodes[m.entry].kind != node_kind::def)
+        return false;
+      node_id fn = m.child(m.entry, 0);
+      if (fn == no_node || m.nodes[fn].kind != node_kind::func) return false;
+    }
+    return true;
+  }
+
+}  // namespace
+
+
+
+std::string ast::serialize(const flat_module &m, source_file *file) {
+  // the atoms the module uses get numbered in the order they're found
+  std::unordered_map<uint32_t, uint32_t> atom_index;
+  std::vector<atom> atoms;
+  std::vector<flat_node> nodes = m.nodes;
+  for (auto &n : nodes) {
+    if (data_is_atom(n.kind)) {
+      auto it = atom_index.find(n.data);
+      if (it == atom_index.end()) {
+        it = atom_index.emplace(n.data, atoms.size()).first;
+        atoms.push_back(atom::from_id(n.data));
+      }
+      n.data = it->second;
+    }
+    // zero stays the missing location
+    n.loc = file->contains(n.loc) ? file->offset(n.loc) + 1 : 0;
+  }
+
+  std::vector<uint32_t> offsets;
+  std::string strings;
+  for (auto &t : m.texts) {
+    offsets.push_back(strings.size());
+    strings += std::string(t);
+  }
+  for (auto &a : atoms) {
+    offsets.push_back(strings.size());
+    strings += a.view();
+  }
+  offsets.push_back(strings.size());
+
+  cache_header h;
+  memcpy(h.magic, cache_magic, sizeof(h.magic));
+  h.version = ast_cache::version;
+  h.source_hash = content_hash(file);
+  h.source_size = file->buffer()->size();
+  h.nodes = nodes.size();
+  h.children = m.children.size();
+  h.numbers = m.numbers.size();
+  h.texts = m.texts.size();
+  h.atoms = atoms.size();
+  h.typedefs = m.typedefs.size();
+  h.defs = m.defs.size();
+  h.string_bytes = strings.size();
+  h.entry = m.entry;
+
+  std::string out;
+  auto put = [&](const void *p, size_t bytes) {
+    out.append((const char *)p, bytes);
+    out.resize(align8(out.size()));
+  };
+  put(&h, sizeof(h));
+  put(nodes.data(), nodes.size() * sizeof(flat_node));
+  put(m.children.data(), m.children.size() * sizeof(node_id));
+  put(m.numbers.data(), m.numbers.size() * sizeof(uint64_t));
+  put(m.typedefs.data(), m.typedefs.size() * sizeof(node_id));
+  put(m.defs.data(), m.defs.size() * sizeof(node_id));
+  put(offsets.data(), offsets.size() * sizeof(uint32_t));
+  put(strings.data(), strings.size());
+  return out;
+}
+
+
+
+bool ast::deserialize(const char *data, size_t size, source_file *file,
+                      flat_module &m) {
+  cache_header h;
+  if (size < sizeof(h)) return false;
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, cache_magic, sizeof(h.magic)) != 0) return false;
+  if (h.version != ast_cache::version) return false;
+  if (h.source_size != file->buffer()->size()) return false;
+  if (h.source_hash != content_hash(file)) return false;
+
+  reader r(data + sizeof(h), data + size);
+  std::vector<uint32_t> offsets;
+  std::vector<char> strings;
+  if (!r.read(m.nodes, h.nodes) || !r.read(m.children, h.children) ||
+      !r.read(m.numbers, h.numbers) || !r.read(m.typedefs, h.typedefs) ||
+      !r.read(m.defs, h.defs) ||
+      !r.read(offsets, (size_t)h.texts + h.atoms + 1) ||
+      !r.read(strings, h.string_bytes))
+    return false;
+  m.entry = h.entry;
+
+  for (size_t i = 0; i + 1 < offsets.size(); i++)
+    if (offsets[i] > offsets[i + 1] || offsets[i + 1] > strings.size())
+      return false;
+  auto string_at = [&](size_t i) {
+    return std::string_view(strings.data() + offsets[i],
+                            offsets[i + 1] - offsets[i]);
+  };
+
+  m.texts.clear();
+  m.texts.reserve(h.texts);
+  for (uint32_t i = 0; i < h.texts; i++) {
+    auto s = string_at(i);
+    m.texts.emplace_back(s.data(), s.size());
+  }
+
+  std::vector<uint32_t> atom_ids(h.atoms);
+  for (uint32_t i = 0; i < h.atoms; i++)
+    atom_ids[i] = atom(string_at(h.texts + i)).id();
+
+  if (!valid(m, h.atoms)) return false;
+
+  // the fixup: names back to atoms, and offsets back to locations
+  size_t source_size = file->buffer()->size();
+  for (auto &n : m.nodes) {
+    if (data_is_atom(n.kind)) n.data = atom_ids[n.data];
+    if (n.loc != 0) {
+      if (n.loc - 1 > source_size) return false;
+      n.loc = file->loc(n.loc - 1);
+    }
+  }
+  return true;
+}
+
+
+
+
+ast_cache::ast_cache(std::string dir) : m_dir(std::move(dir)) {
+  // only the last directory is made. Failing here just means every store
+  // fails later
+  mkdir(m_dir.c_str(), 0755);
+}
+
+
+std::string ast_cache::path_for(source_file *file) {
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx-v%u.ast",
+           (unsigned long long)content_hash(file), version);
+  return m_dir + name;
+}
+
+
+std::unique_ptr<ast::module> ast_cache::load(source_file *file) {
+  auto buf = source_buffer::map_file(path_for(file).c_str());
+  if (buf == nullptr) return nullptr;
+  flat_module m;
+  if (!deserialize(buf->data(), buf->size(), file, m)) return nullptr;
+  try {
+    return unflatten(m);
+  } catch (std::logic_error &) {
+    // a condition or field somewhere other than in an if or typedef
+    return nullptr;
+  }
+}
+
+
+bool ast_cache::store(source_file *file, ast::module &mod) {
+  std::string bytes = serialize(flatten(mod), file);
+  std::string path = path_for(file);
+
+  // written next to the entry and renamed over it, so readers never see a
+  // partial entry
+  static std::atomic<unsigned> next_tmp;
+  std::string tmp = path + "." + std::to_string(getpid()) + "." +
+                    std::to_string(next_tmp++) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (fp == nullptr) return false;
+  bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+  ok = fclose(fp) == 0 && ok;
+  if (ok) ok = rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(tmp.c_str());
+  return ok;
+}
+
+
+std::unique_ptr<ast::module> ast_cache::parse(source_file *file,
+                                              bool streaming) {
+  if (auto mod = load(file); mod) return mod;
+  auto mod = parse_module(file, false, streaming);
+  store(file, *mod);
+  return mod;
+}
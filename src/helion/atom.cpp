@@ -0,0 +1,143 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/atom.h>
+#include <string.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using namespace helion;
+
+
+namespace {
+
+  struct atom_entry {
+    const char *data;
+    uint32_t length;
+  };
+
+  /**
+   * the process wide atom table. Entries are stored in fixed size segments
+   * that are never moved or freed, so looking up the bytes of an atom doesn't
+   * need the lock: an id can only be handed out after its entry is written
+   */
+  class atom_table {
+    static constexpr size_t segment_bits = 16;
+    static constexpr size_t segment_size = 1 << segment_bits;
+    static constexpr size_t max_segments = 1 << 16;
+    static constexpr size_t block_size = 64 << 10;
+
+    std::mutex lock;
+    std::unordered_map<std::string_view, uint32_t> ids;
+    uint32_t count = 0;
+    std::unique_ptr<atom_entry[]> segments[max_segments];
+
+    // the bytes of every atom, packed into large blocks
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *block_pos = nullptr;
+    size_t block_left = 0;
+
+    const char *store(std::string_view s) {
+      size_t need = s.size() + 1;
+      if (need > block_left) {
+        size_t size = std::max(need, block_size);
+        blocks.emplace_back(new char[size]);
+        block_pos = blocks.back().get();
+        block_left = size;
+      }
+      char *dst = block_pos;
+      memcpy(dst, s.data(), s.size());
+      dst[s.size()] = '\0';
+      block_pos += need;
+      block_left -= need;
+      return dst;
+    }
+
+   public:
+    // the empty atom is always interned first, as id zero
+    atom_table() { intern(""); }
+
+    uint32_t intern(std::string_view s) {
+      std::unique_lock<std::mutex> l(lock);
+      auto it = ids.find(s);
+      if (it != ids.end()) return it->second;
+
+      uint32_t id = count;
+      auto &seg = segments[id >> segment_bits];
+      if (seg == nullptr) {
+        if ((id >> segment_bits) >= max_segments)
+          throw std::logic_error("too many distinct identifiers");
+        seg.reset(new atom_entry[segment_size]);
+      }
+      const char *bytes = store(s);
+      seg[id & (segment_size - 1)] = {bytes, (uint32_t)s.size()};
+      ids.emplace(std::string_view(bytes, s.size()), id);
+      count++;
+      return id;
+    }
+
+    inline const atom_entry &get(uint32_t id) {
+      return segments[id >> segment_bits][id & (segment_size - 1)];
+    }
+  };
+
+
+  // initialized exactly once, even if first used from several threads
+  atom_table &table(void) {
+    static atom_table t;
+    return t;
+  }
+
+
+  /**
+   * each thread keeps a small cache of the atoms it interned recently, so the
+   * common case of seeing the same identifiers over and over while lexing
+   * doesn't touch the shared lock
+   */
+  struct cache_slot {
+    size_t hash;
+    const char *data;
+    uint32_t length;
+    uint32_t id;
+  };
+  thread_local cache_slot atom_cache[1024];
+
+  // a hash of the length and the first and last eight bytes. Cheap enough to
+  // run on every identifier, and the memcmp on a hit makes up for the rest
+  inline size_t cache_hash(std::string_view s) {
+    uint64_t a = 0, b = 0;
+    size_t n = s.size() < 8 ? s.size() : 8;
+    memcpy(&a, s.data(), n);
+    memcpy(&b, s.data() + s.size() - n, n);
+    uint64_t h = (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full);
+    return h ^ (h >> 32) ^ s.size();
+  }
+
+}  // namespace
+
+
+
+atom::atom(std::string_view s) {
+  if (s.empty()) return;
+
+  size_t h = cache_hash(s);
+  auto &slot = atom_cache[h & 1023];
+  if (slot.hash == h && slot.length == s.size() &&
+      memcmp(slot.data, s.data(), s.size()) == 0) {
+    m_id = slot.id;
+    return;
+  }
+
+  m_id = table().intern(s);
+  slot = {h, table().get(m_id).data, (uint32_t)s.size(), m_id};
+}
+
+
+
+std::string_view atom::view(void) const {
+  auto &e = table().get(m_id);
+  return std::string_view(e.data, e.length);
+}
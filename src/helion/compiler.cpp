@@ -6,6 +6,7 @@
 #include <helion/core.h>
 #include <helion/gc.h>
 #include <iostream>
+#include <thread>
 #include <unordered_map>
 
 using namespace helion;
@@ -51,15 +52,15 @@ namespace helion {
   };
 
   struct cg_binding {
-    std::string name;
+    atom name;
     datatype *type;
     llvm::Value *val;
   };
 
   class cg_scope {
    protected:
-    std::unordered_map<std::string, datatype *> m_types;
-    std::unordered_map<std::string, std::unique_ptr<cg_binding>> m_bindings;
+    std::unordered_map<atom, datatype *> m_types;
+    std::unordered_map<atom, std::unique_ptr<cg_binding>> m_bindings;
     std::unordered_map<llvm::Value *, datatype *> m_val_types;
     cg_scope *m_parent;
 
@@ -74,34 +75,36 @@ namespace helion {
       return ptr;
     }
 
-    cg_binding *find_binding(std::string &name) {
+    cg_binding *find_binding(atom name) {
       auto *sc = this;
       while (sc != nullptr) {
-        if (sc->m_bindings.count(name) != 0) {
-          return sc->m_bindings[name].get();
+        auto it = sc->m_bindings.find(name);
+        if (it != sc->m_bindings.end()) {
+          return it->second.get();
         }
         sc = sc->m_parent;
       }
       return nullptr;
     }
 
-    void set_binding(std::string name, std::unique_ptr<cg_binding> binding) {
+    void set_binding(atom name, std::unique_ptr<cg_binding> binding) {
       m_bindings[name] = std::move(binding);
     }
 
     // type lookups
-    datatype *find_type(std::string name) {
+    datatype *find_type(atom name) {
       auto *sc = this;
       while (sc != nullptr) {
-        if (sc->m_types.count(name) != 0) {
-          return sc->m_types[name];
+        auto it = sc->m_types.find(name);
+        if (it != sc->m_types.end()) {
+          return it->second;
         }
         sc = sc->m_parent;
       }
       return nullptr;
     }
 
-    void set_type(std::string name, datatype *T) { m_types[name] = T; }
+    void set_type(atom name, datatype *T) { m_types[name] = T; }
 
 
 
@@ -125,7 +128,7 @@ namespace helion {
       text s;
       for (auto &t : m_types) {
         s += indent;
-        s += t.first;
+        s += t.first.str();
         s += " : ";
         s += t.second->str();
         s += "\n";
@@ -400,9 +403,9 @@ llvm::Value *ast::typeassert::codegen(cg_ctx &ctx, cg_scope *sc,
 static datatype *declare_type(std::shared_ptr<ast::typedef_node> n,
                               cg_scope *scp) {
   auto type = n->type;
-  std::string name = type->name;
+  atom name = type->name;
 
-  std::vector<std::string> params;
+  std::vector<atom> params;
   for (auto &p : type->params) {
     params.push_back(p->name);
     if (p->params.size() != 0)
@@ -411,6 +414,7 @@ static datatype *declare_type(std::shared_ptr<ast::typedef_node> n,
 
 
   auto *t = &datatype::create(type->name, *any_type, params);
+  t->ti->value_type = n->value;
 
   // simply store the ast node in the type for now. Fields are sorted out
   // at specialization and when needed
@@ -422,8 +426,7 @@ static datatype *declare_type(std::shared_ptr<ast::typedef_node> n,
 }
 
 datatype *helion::specialize(std::shared_ptr<ast::type_node> &tn, cg_scope *s) {
-  std::string name = tn->name;
-  datatype *t = s->find_type(name);
+  datatype *t = s->find_type(tn->name);
 
   std::vector<datatype *> p;
 
@@ -438,6 +441,67 @@ datatype *helion::specialize(datatype *t, cg_scope *scp) {
   return specialize(t, {}, scp);
 }
 
+
+
+namespace {
+  // the type parameters of a specialization being built, and the types
+  // they're bound to. These are per call, as the scopes are shared by every
+  // thread, and a binding there would be seen by any other specialization
+  // using the same parameter name
+  struct type_bindings {
+    const std::vector<atom> &names;
+    const std::vector<datatype *> &types;
+
+    datatype *find(atom name) const {
+      for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name) return types[i];
+      return nullptr;
+    }
+  };
+}  // namespace
+
+
+// the type of a field, with the parameters of the type it's in bound
+static datatype *specialize_field(std::shared_ptr<ast::type_node> &tn,
+                                  const type_bindings &b, cg_scope *s) {
+  datatype *t = b.find(tn->name);
+  if (t == nullptr) t = s->find_type(tn->name);
+
+  std::vector<datatype *> p;
+  for (auto &param : tn->params) {
+    p.push_back(specialize_field(param, b, s));
+  }
+  return specialize(t, p, s);
+}
+
+
+// how deep this thread is in specializations it's filling in, and the ones
+// it came across in the meantime that weren't filled in yet. A field only
+// needs the pointer to its type, so those are only waited for once the
+// outermost specialization is done. Waiting on them while filling in could
+// deadlock with a thread filling in a type that refers back to this one
+static thread_local int spec_depth = 0;
+static thread_local std::vector<datatype *> spec_pending;
+
+
+static void wait_completed(datatype *t) {
+  while (!t->completed.load(std::memory_order_acquire))
+    std::this_thread::yield();
+}
+
+
+// returns a specialization that may not be filled in yet to the caller.
+// Callers outside a specialization only ever see it once it is
+static datatype *hand_out(datatype *spec) {
+  if (spec->completed.load(std::memory_order_acquire)) return spec;
+  if (spec_depth > 0)
+    spec_pending.push_back(spec);
+  else
+    wait_completed(spec);
+  return spec;
+}
+
+
 datatype *helion::specialize(datatype *t, std::vector<datatype *> params,
                              cg_scope *scp) {
   if (t->ti->style == type_style::FLOATING ||
@@ -449,7 +513,7 @@ datatype *helion::specialize(datatype *t, std::vector<datatype *> params,
   if (params.size() != t->ti->param_names.size()) {
     std::string err;
     err += "Unable to specialize type ";
-    err += t->ti->name;
+    err += t->ti->name.str();
     err += " with invalid number of parameters. Expected ";
     err += std::to_string(t->ti->param_names.size());
     err += ". Got ";
@@ -461,35 +525,43 @@ datatype *helion::specialize(datatype *t, std::vector<datatype *> params,
   // short circuit and return it
   if (t->specialized) return t;
 
-  // Step 3. Search through the specializations in the typeinfo and
-  //         attempt to find an existing specialization
-  for (auto &s : t->ti->specializations) {
-    if (s->param_types == params) return s.get();
-  }
+  // Step 3. Look up an existing specialization in the hash consed table
+  if (auto *s = t->find_spec(params)) return hand_out(s);
 
   // Step 4. Create a new specialization, this is one of the more complicated
   //         parts of the specialization lookup
 
-  // spawn a scope that the specialization will be built in
-  auto ns = cg_scope();
-  ns.set_parent(scp);
-
-  // loop over and fill in the new scope
-  for (size_t i = 0; i < t->ti->param_names.size(); i++) {
-    ns.set_type(t->ti->param_names[i], params[i]);
-  }
-
   // allocate a new instance of the datatype
-  auto spec = t->spawn_spec();
-  spec->param_types = params;
-  spec->ti = t->ti;  // fill in the type info
+  // it's registered before its fields are specialized, so a field that
+  // refers back to this type finds it. No lock is held while they are, so
+  // two threads specializing types that refer to each other can't deadlock
+  bool created;
+  auto spec = t->spawn_spec(params, created);
+  // some other thread is filling it in
+  if (!created) return hand_out(spec);
   auto node = t->ti->node;
 
-  for (auto &f : node->fields) {
-    auto *ft = specialize(f.type, &ns);
-    spec->add_field(f.name, ft);
+  type_bindings bindings{t->ti->param_names, params};
+  spec_depth++;
+  try {
+    for (auto &f : node->fields) {
+      auto *ft = specialize_field(f.type, bindings, scp);
+      spec->add_field(f.name, ft);
+    }
+  } catch (...) {
+    // it's marked done anyway, so no other thread waits on it forever. The
+    // error ends the compile
+    spec->completed.store(true, std::memory_order_release);
+    if (--spec_depth == 0) spec_pending.clear();
+    throw;
   }
+  spec->completed.store(true, std::memory_order_release);
 
+  if (--spec_depth == 0) {
+    auto pending = std::move(spec_pending);
+    spec_pending.clear();
+    for (auto *p : pending) wait_completed(p);
+  }
   return spec;
 }
 
@@ -501,13 +573,15 @@ static std::vector<std::unique_ptr<method>> method_table;
 // in the global_scope
 method *method::create(std::shared_ptr<ast::def> &n) {
   method *m = method::create(n->fn, global_scope.get());
-  m->name = n->name;
+  m->name = n->name.str();
   return m;
 }
 
 
 
 method *method::create(std::shared_ptr<ast::func> &fn, cg_scope *scp) {
+  // a body the parser skipped is parsed once it's going to be compiled
+  fn->parse_body();
   auto m = std::make_unique<method>();
   auto mptr = m.get();
 
@@ -553,7 +627,7 @@ static void pattern_match_name(ast::type_node *n, datatype *on, cg_scope *s) {
     auto bound = s->find_type(n->name);
     if (bound != on) {
       std::string err;
-      err += n->name;
+      err += n->name.str();
       err += " is bound to ";
       err += bound->str();
       throw pattern_match_error(*n, *on, err);
@@ -618,17 +692,26 @@ helion::pattern_match_error::pattern_match_error(ast::type_node &n,
 
 
 
-global_variable *module::find(std::string s) {
-  if (globals.count(s) == 0) return nullptr;
-  return globals.at(s).get();
+global_variable *module::find(atom name) {
+  auto it = globals.find(name);
+  if (it == globals.end()) return nullptr;
+  return it->second.get();
 }
 
 
-void *module::global_create(std::string name, datatype *type) {
+void *module::global_create(atom name, datatype *type) {
   auto llt = type->to_llvm();
-  auto size = data_layout.getTypeAllocSize(llt);
+  // objects are allocated by their layout, which is what their llvm struct
+  // is made from
+  uint64_t size = type->ti->style == type_style::OBJECT
+                      ? type->layout().size
+                      : data_layout.getTypeAllocSize(llt);
   // allocate that memory using the garbage collector
   void *data = gc::alloc(size);
+  if (type->ti->style == type_style::OBJECT && type->layout().cold_size != 0) {
+    auto **cold = (void **)((char *)data + type_layout::cold_offset);
+    *cold = gc::alloc(type->layout().cold_size);
+  }
   auto glob = std::make_unique<global_variable>();
 
   glob->name = name;
@@ -642,4 +725,9 @@ void *module::global_create(std::string name, datatype *type) {
 
 
 
-global_variable::~global_variable() { gc::free(data); }
+global_variable::~global_variable() {
+  // the cold side object global_create made along with it
+  if (type->ti->style == type_style::OBJECT && type->layout().cold_size != 0)
+    gc::free(*(void **)((char *)data + type_layout::cold_offset));
+  gc::free(data);
+}
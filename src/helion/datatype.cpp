@@ -3,6 +3,7 @@
 
 #include <helion/core.h>
 #include <helion/util.h>
+#include <algorithm>
 
 using namespace helion;
 
@@ -15,9 +16,71 @@ datatype *helion::any_type;
 datatype *helion::int32_type;
 datatype *helion::float32_type;
 
+bool helion::reorder_fields = true;
+
 
 static std::vector<std::unique_ptr<datatype>> types;
 
+// every type by id, specializations included. Those are owned by the
+// typeinfo of the type they specialize
+static std::vector<datatype *> type_ids;
+
+// held while adding to types and type_ids, which is rare enough that it
+// isn't worth doing without a lock
+static std::mutex registry_lock;
+
+// held while making a layout or an llvm type. Both fill in a type the first
+// time it's used, possibly from several threads, and recurse into the types
+// of its fields, which a per type lock could deadlock on
+static std::recursive_mutex lowering_lock;
+
+// subtype results for queries that involve type parameters, which would
+// otherwise recurse over them every time. Keyed on the ids of both types.
+// Each thread has its own, so checks never wait on each other
+static thread_local std::unordered_map<uint64_t, bool> subtype_memo;
+
+
+// registry_lock must be held
+static uint32_t register_type(datatype *t) {
+  t->id = type_ids.size();
+  type_ids.push_back(t);
+  return t->id;
+}
+
+
+// register a new unspecialized type and give it a place in the hierarchy,
+// under its supertype. registry_lock must be held
+static void register_base(datatype *t) {
+  auto *ti = t->ti.get();
+  ti->base_id = register_type(t);
+  // Any (and the first of the primitive types) are created before the type
+  // they would point to, so they're roots
+  if (ti->super != nullptr && ti->super != t) {
+    auto *sup = ti->super->ti.get();
+    ti->depth = sup->depth + 1;
+    ti->display = sup->display;
+  }
+  ti->display.push_back(ti->base_id);
+}
+
+
+// does the unspecialized type of `a` inherit from that of `b` (or is it
+// the same)
+static inline bool inherits(const typeinfo *a, const typeinfo *b) {
+  return a->depth >= b->depth && a->display[b->depth] == b->base_id;
+}
+
+
+static size_t spec_hash(uint32_t base, const std::vector<datatype *> &params) {
+  size_t h = base;
+  for (auto *p : params) {
+    // a method with no return type has a null parameter
+    size_t id = p == nullptr ? ~0u : p->id;
+    h ^= id + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
 
 
 void helion::init_types(void) {
@@ -27,13 +90,40 @@ void helion::init_types(void) {
   float32_type = &datatype::create_float("Float", 32);
 }
 
-// line for line implementation of the subtype algorithm from the julia paper.
+// every parameter of A is a subtype of the one in the same place in B. The
+// result is memoized, as this is what makes subtype recursive
+static bool params_subtype(datatype *A, datatype *B) {
+  if (A->param_types.empty()) return true;
+
+  uint64_t key = ((uint64_t)A->id << 32) | B->id;
+  auto it = subtype_memo.find(key);
+  if (it != subtype_memo.end()) return it->second;
+
+  bool res = true;
+  for (size_t i = 0; i < A->param_types.size(); i++) {
+    auto &T = A->param_types[i];
+    auto &S = B->param_types[i];
+    // if T is not a subtype of S, then A isn't a subtype of B
+    if (subtype(T, S) == false) {
+      res = false;
+      break;
+    }
+  }
+  subtype_memo[key] = res;
+  return res;
+}
+
+// based on the subtype algorithm from the julia paper.
 // ([1209.5145v1] Julia: A Fast Dynamic Language for Technical, Algorithm 3)
+// The supertype chain is checked with the display instead of being walked.
 //
 // Check if A is <= B (A is a subtype or equal to B)
 bool helion::subtype(datatype *A, datatype *B) {
   using ts = type_style;
 
+  // types are hash consed, so a type is only ever equal to itself
+  if (A == B) return true;
+
   if (A->ti->style != B->ti->style) return false;
 
   if (A->ti->style == ts::INTEGER || A->ti->style == ts::FLOATING) {
@@ -46,17 +136,7 @@ bool helion::subtype(datatype *A, datatype *B) {
     if (A->param_types.size() != B->param_types.size()) {
       return false;
     }
-
-    // all of the parameter types must be subtypes
-    for (size_t i = 0; i < A->param_types.size(); i++) {
-      auto &T = A->param_types[i];
-      auto &S = B->param_types[i];
-      // if T is not a subtype of S, then A isn't a subtype of B
-      if (subtype(T, S) == false) {
-        return false;
-      }
-    }
-    return true;
+    return params_subtype(A, B);
   }
 
   if (A->ti->style == ts::OBJECT) {
@@ -65,29 +145,13 @@ bool helion::subtype(datatype *A, datatype *B) {
       return false;
     }
 
+    // now we check if the base type A <= B, in constant time
+    if (!inherits(A->ti.get(), B->ti.get())) return false;
 
-
-    // now we check if the base type A <= B by walking the inheritence list
-    while (A != any_type) {
-      // TODO: use type ids, not string names...
-      if (A->ti->name == B->ti->name) {
-        // all of the parameter types must be subtypes
-        for (size_t i = 0; i < A->param_types.size(); i++) {
-          auto &T = A->param_types[i];
-          auto &S = B->param_types[i];
-          // if T is not a subtype of S, then A isn't a subtype of B
-          if (subtype(T, S) == false) {
-            return false;
-          }
-        }
-
-        return true;
-      }
-      A = A->ti->super;
-    }
-
-    // all the checks pass for object types
-    return B == any_type;
+    // the parameters only have to match if it's the same base type, as
+    // supertypes are unspecialized
+    if (A->ti->base_id == B->ti->base_id) return params_subtype(A, B);
+    return true;
   }
 
 
@@ -98,72 +162,70 @@ bool helion::subtype(datatype *A, datatype *B) {
 
 
 text datatype::str() {
-  text s;
-  if (ti->style == type_style::INTEGER) {
-    s += ti->name;
-    return s;
-  } else if (ti->style == type_style::FLOATING) {
-    s += ti->name;
-    return s;
+  std::string s;
+  llvm::raw_string_ostream out(s);
+  print(out);
+  return text(out.str());
+}
+
+
+void datatype::print(llvm::raw_ostream &out) {
+  auto name = ti->name.view();
+  if (ti->style == type_style::INTEGER || ti->style == type_style::FLOATING) {
+    out << llvm::StringRef(name.data(), name.size());
   } else if (ti->style == type_style::OBJECT ||
              ti->style == type_style::TUPLE || ti->style == type_style::UNION) {
-    if (ti->style == type_style::OBJECT) s += ti->name;
-    if (ti->style == type_style::TUPLE) s += "Tuple";
-    if (ti->style == type_style::UNION) s += "Union";
+    if (ti->style == type_style::OBJECT)
+      out << llvm::StringRef(name.data(), name.size());
+    if (ti->style == type_style::TUPLE) out << "Tuple";
+    if (ti->style == type_style::UNION) out << "Union";
 
     if (specialized) {
       if (param_types.size() > 0) {
-        s += "{";
+        out << "{";
         for (size_t i = 0; i < param_types.size(); i++) {
           auto &v = param_types[i];
-          if (v != nullptr) {
-            s += v->str();
-          }
-          if (i < param_types.size() - 1) s += ", ";
+          if (v != nullptr) v->print(out);
+          if (i < param_types.size() - 1) out << ", ";
         }
-        s += "}";
+        out << "}";
       }
     } else {
       if (ti->param_names.size() > 0) {
-        s += "{";
+        out << "{";
         for (size_t i = 0; i < ti->param_names.size(); i++) {
-          s += ti->param_names[i];
-          if (i < ti->param_names.size() - 1) s += ", ";
+          out << ti->param_names[i].c_str();
+          if (i < ti->param_names.size() - 1) out << ", ";
         }
-        s += "}";
+        out << "}";
       }
     }
 
   } else if (ti->style == type_style::METHOD) {
-    s += "Fn{";
+    out << "Fn{";
     if (specialized) {
       for (size_t i = 1; i < param_types.size(); i++) {
-        auto &param = param_types[i];
-        s += param->str();
-        if (i < param_types.size() - 1) {
-          s += ", ";
-        }
+        param_types[i]->print(out);
+        if (i < param_types.size() - 1) out << ", ";
       }
 
       if (param_types[0] != nullptr) {
-        s += " : ";
-        s += param_types[0]->str();
+        out << " : ";
+        param_types[0]->print(out);
       }
     } else {
-      s += "UNKNOWN, UNEXPECTED UNSPECIALIZED METHOD TYPE";
+      out << "UNKNOWN, UNEXPECTED UNSPECIALIZED METHOD TYPE";
     }
-    s += "}";
-  } else {
-    s += "";
+    out << "}";
   }
-
-  return s;
 }
 
-datatype &datatype::create(std::string name, datatype &sup,
-                           std::vector<std::string> params) {
+datatype &datatype::create(atom name, datatype &sup,
+                           std::vector<atom> params) {
   std::unique_ptr<datatype> t(new datatype(name, sup));
   t->ti->param_names = params;
+  std::lock_guard<std::mutex> g(registry_lock);
+  register_base(t.get());
   int tid = types.size();
   types.emplace_back(std::move(t));
   return *types[tid];
@@ -171,10 +233,106 @@ datatype &datatype::create(std::string name, datatype &sup,
 
 
 
-datatype &datatype::create_integer(std::string name, int bits) {
+datatype *datatype::from_id(uint32_t id) {
+  std::lock_guard<std::mutex> g(registry_lock);
+  if (id >= type_ids.size()) return nullptr;
+  return type_ids[id];
+}
+
+
+
+datatype *spec_set::find(size_t hash,
+                         const std::vector<datatype *> &params) const {
+  auto *t = m_table.load(std::memory_order_acquire);
+  if (t == nullptr) return nullptr;
+  for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+    auto *s = t->slots[i].val.load(std::memory_order_acquire);
+    // tables are never full, so every probe ends at an empty slot
+    if (s == nullptr) return nullptr;
+    // the parameters are hash consed, so comparing pointers is exact
+    if (t->slots[i].hash == hash && s->param_types == params) return s;
+  }
+}
+
+
+
+void spec_set::place(table &t, size_t hash, datatype *s) {
+  size_t i = hash & t.mask;
+  while (t.slots[i].val.load(std::memory_order_relaxed) != nullptr) {
+    i = (i + 1) & t.mask;
+  }
+  t.slots[i].hash = hash;
+  t.slots[i].val.store(s, std::memory_order_release);
+}
+
+
+
+void spec_set::insert(size_t hash, datatype *s) {
+  auto *t = m_table.load(std::memory_order_relaxed);
+
+  // keep it at most half full. Readers still on the old table won't see
+  // what's added after it was replaced, and find out under the lock
+  if (t == nullptr || (m_count + 1) * 2 > t->mask + 1) {
+    size_t cap = t == nullptr ? 8 : (t->mask + 1) * 2;
+    auto grown = std::make_unique<table>();
+    grown->mask = cap - 1;
+    grown->slots.reset(new slot[cap]);
+    if (t != nullptr) {
+      for (size_t i = 0; i <= t->mask; i++) {
+        auto *old = t->slots[i].val.load(std::memory_order_relaxed);
+        if (old != nullptr) place(*grown, t->slots[i].hash, old);
+      }
+    }
+    grown->prev = std::move(m_owned);
+    m_owned = std::move(grown);
+    t = m_owned.get();
+    m_table.store(t, std::memory_order_release);
+  }
+
+  place(*t, hash, s);
+  m_count++;
+}
+
+
+
+datatype *datatype::find_spec(const std::vector<datatype *> &params) {
+  return ti->specs.find(spec_hash(ti->base_id, params), params);
+}
+
+
+
+datatype *datatype::spawn_spec(std::vector<datatype *> params,
+                               bool &created) {
+  size_t hash = spec_hash(ti->base_id, params);
+  std::lock_guard<std::mutex> g(ti->lock);
+
+  // another thread may have made it since the caller looked
+  if (auto *s = ti->specs.find(hash, params)) {
+    created = false;
+    return s;
+  }
+
+  auto n = new datatype(*this);
+  n->specialized = true;
+  n->param_types = std::move(params);
+  {
+    std::lock_guard<std::mutex> rg(registry_lock);
+    register_type(n);
+  }
+  ti->specializations.push_back(std::unique_ptr<datatype>(n));
+  ti->specs.insert(hash, n);
+  created = true;
+  return n;
+}
+
+
+
+datatype &datatype::create_integer(atom name, int bits) {
   std::unique_ptr<datatype> t(new datatype(name, *int32_type));
+  std::lock_guard<std::mutex> g(registry_lock);
   int tid = types.size();
   t->ti->bits = bits;
+  register_base(t.get());
   t->specialized = true;
   t->ti->style = type_style::INTEGER;
   types.emplace_back(std::move(t));
@@ -182,17 +340,19 @@ datatype &datatype::create_integer(std::string name, int bits) {
 }
 
 
-datatype &datatype::create_float(std::string name, int bits) {
+datatype &datatype::create_float(atom name, int bits) {
   std::unique_ptr<datatype> t(new datatype(name, *float32_type));
+  std::lock_guard<std::mutex> g(registry_lock);
   int tid = types.size();
   t->ti->bits = bits;
+  register_base(t.get());
   t->specialized = true;
   t->ti->style = type_style::FLOATING;
   types.emplace_back(std::move(t));
   return *types[tid];
 }
 
-void datatype::add_field(std::string name, datatype *type) {
+void datatype::add_field(atom name, datatype *type) {
   for (auto &f : fields) {
     if (f.name == name) {
       f.type = type;
@@ -207,7 +367,159 @@ void datatype::add_field(std::string name, datatype *type) {
 }
 
 
+// primitives and values are stored in the object, anything else by
+// reference
+static bool stored_inline(datatype *t) {
+  return t->ti->style == type_style::INTEGER ||
+         t->ti->style == type_style::FLOATING || t->is_value();
+}
+
+
+// the size and natural alignment of a field of type `t`. These are the
+// same as llvm gives the types to_llvm makes for it on the targets we jit
+// for: integers are rounded up to a power of two bytes, but aren't aligned
+// past a word
+static uint32_t field_size(datatype *t, uint32_t &align) {
+  if (t->is_value()) {
+    auto &l = t->layout();
+    align = l.align;
+    return l.size;
+  }
+
+  uint32_t size = sizeof(void *);
+  if (stored_inline(t)) {
+    size = 1;
+    while (size * 8 < (uint32_t)t->ti->bits) size *= 2;
+  }
+  align = std::min<uint32_t>(size, sizeof(void *));
+  return size;
+}
+
+
+static uint32_t align_to(uint32_t n, uint32_t align) {
+  return (n + align - 1) / align * align;
+}
+
+
+
+const type_layout &datatype::layout(void) {
+  std::lock_guard<std::recursive_mutex> g(lowering_lock);
+  if (m_layout != nullptr) return *m_layout;
+
+  if (m_laying_out) {
+    std::string err = "value type ";
+    err += str();
+    err += " contains itself";
+    throw std::logic_error(err);
+  }
+
+  auto l = std::make_unique<type_layout>();
+  const uint32_t word = sizeof(void *);
+  const bool value = is_value();
+  const uint32_t header = value ? 0 : 2 * word;
+
+  size_t count = fields.size();
+  std::vector<uint32_t> sizes(count), aligns(count);
+  m_laying_out = true;
+  try {
+    for (size_t i = 0; i < count; i++) {
+      sizes[i] = field_size(fields[i].type, aligns[i]);
+    }
+  } catch (...) {
+    m_laying_out = false;
+    throw;
+  }
+  m_laying_out = false;
+
+  // values are only aligned as much as their fields need, objects always
+  // to a word for the header
+  uint32_t align = value ? 1 : word;
+  for (auto a : aligns) align = std::max(align, a);
+
+  // what it would be without any of this, for the report
+  uint32_t off = header;
+  l->packed_size = header;
+  for (size_t i = 0; i < count; i++) {
+    off = align_to(off, aligns[i]) + sizes[i];
+    l->packed_size += sizes[i];
+  }
+  l->declared_size = align_to(off, align);
+
+  // a value is copied around whole, so it doesn't get a cold object
+  std::vector<uint32_t> hot, cold;
+  for (uint32_t i = 0; i < count; i++) {
+    (fields[i].cold && !value ? cold : hot).push_back(i);
+  }
+
+  // largest alignment first leaves no gaps, as every size is a multiple of
+  // its alignment. Stable, so it's still in declaration order otherwise
+  if (reorder_fields) {
+    auto by_align = [&](uint32_t a, uint32_t b) {
+      return aligns[a] > aligns[b];
+    };
+    std::stable_sort(hot.begin(), hot.end(), by_align);
+    std::stable_sort(cold.begin(), cold.end(), by_align);
+  }
+
+  l->fields.resize(count);
+
+  // the header, then the pointer to the cold object
+  uint32_t index = value ? 0 : cold.empty() ? 2 : 3;
+  off = cold.empty() ? header : header + word;
+  for (auto i : hot) {
+    off = align_to(off, aligns[i]);
+    l->fields[i].offset = off;
+    l->fields[i].index = index++;
+    off += sizes[i];
+  }
+  l->align = align;
+  l->size = align_to(off, align);
+
+  index = 0;
+  off = 0;
+  for (auto i : cold) {
+    off = align_to(off, aligns[i]);
+    l->fields[i].offset = off;
+    l->fields[i].index = index++;
+    l->fields[i].cold = true;
+    off += sizes[i];
+    l->cold_align = std::max(l->cold_align, aligns[i]);
+  }
+  l->cold_size = align_to(off, l->cold_align);
+
+  l->order = std::move(hot);
+  l->order.insert(l->order.end(), cold.begin(), cold.end());
+
+  m_layout = std::move(l);
+  return *m_layout;
+}
+
+
+
+void helion::print_layout_report(llvm::raw_ostream &out) {
+  std::lock_guard<std::mutex> g(registry_lock);
+  std::lock_guard<std::recursive_mutex> lg(lowering_lock);
+  int64_t saved = 0;
+  for (auto *t : type_ids) {
+    if (t->ti->style != type_style::OBJECT) continue;
+    if (t->m_layout == nullptr) continue;
+    auto &l = *t->m_layout;
+    // the pointer to a cold object can cost more than it saves
+    int64_t diff = (int64_t)l.declared_size - l.size - l.cold_size;
+    t->print(out);
+    out << ": " << l.size << " bytes";
+    if (l.cold_size != 0) out << " + " << l.cold_size << " cold";
+    out << ", " << l.declared_size << " in declaration order (" << diff
+        << " saved), " << l.packed_size << " packed\n";
+    saved += diff;
+  }
+  out << saved << " bytes saved in total\n";
+}
+
+
+
 llvm::Type *datatype::to_llvm(void) {
+  std::lock_guard<std::recursive_mutex> g(lowering_lock);
   if (type_decl != nullptr) return type_decl;
 
   if (ti->style == type_style::INTEGER) {
@@ -220,30 +532,60 @@ llvm::Type *datatype::to_llvm(void) {
     } else {
       throw std::logic_error("Floats must be 32 or 64 bit");
     }
+  } else if (ti->style == type_style::OBJECT && ti->value_type) {
+    std::string s = str();
+    auto stct = llvm::StructType::create(llvm_ctx, s);
+    type_decl = stct;
+
+    // just the fields, with no header
+    auto &l = layout();
+    std::vector<llvm::Type *> flds;
+    for (auto i : l.order) {
+      auto &f = fields[i];
+      llvm::Type *field = f.type->to_llvm();
+      if (!stored_inline(f.type)) {
+        field = field != nullptr ? field->getPointerTo()
+                                 : llvm::Type::getInt8PtrTy(llvm_ctx);
+      }
+      flds.push_back(field);
+    }
+    stct->setBody(flds, false);
   } else if (ti->style == type_style::OBJECT) {
     std::string s = str();
     auto stct = llvm::StructType::create(llvm_ctx, s);
     type_decl = stct;
 
 
-    std::string tname = str();
+    auto &l = layout();
     std::vector<llvm::Type *> flds;
     // push back a voidptr type
 
     auto vd = llvm::Type::getInt8PtrTy(llvm_ctx);
     flds.push_back(vd);
 
-    flds.push_back(any_type->to_llvm());
+    // the supertype, by reference, as Any would contain itself otherwise
+    flds.push_back(any_type->to_llvm()->getPointerTo());
+
+    llvm::StructType *cold = nullptr;
+    std::vector<llvm::Type *> cold_flds;
+    if (l.cold_size != 0) {
+      cold = llvm::StructType::create(llvm_ctx, s + ".cold");
+      flds.push_back(cold->getPointerTo());
+    }
+
     // TODO(superclass): Add in superclass fields here.
-    for (auto &f : fields) {
+    for (auto i : l.order) {
+      auto &f = fields[i];
       llvm::Type *field = f.type->to_llvm();
-      if (f.type->ti->style == type_style::OBJECT) {
-        field = field->getPointerTo();
+      if (!stored_inline(f.type)) {
+        field = field != nullptr ? field->getPointerTo() : vd;
       }
-      flds.push_back(field);
+      (l.fields[i].cold ? cold_flds : flds).push_back(field);
     }
 
-    stct->setBody(flds, true);
+    // not packed, so llvm aligns the fields where the layout put them
+    stct->setBody(flds, false);
+    if (cold != nullptr) cold->setBody(cold_flds, false);
   } else if (ti->style == type_style::SLICE) {
     std::string s = str();
     auto stct = llvm::StructType::create(llvm_ctx, s);
@@ -253,9 +595,11 @@ llvm::Type *datatype::to_llvm(void) {
     flds.push_back(llvm::Type::getInt32Ty(llvm_ctx));
     flds.push_back(llvm::Type::getInt32Ty(llvm_ctx));
 
+    // values are stored inline in the slice's elements, so it points to
+    // them directly rather than to pointers to them
     for (auto &f : fields) {
       llvm::Type *field = f.type->to_llvm();
-      if (f.type->ti->style == type_style::OBJECT) {
+      if (!stored_inline(f.type)) {
         field = field->getPointerTo();
       }
       flds.push_back(field->getPointerTo());
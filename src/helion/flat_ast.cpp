@@ -0,0 +1,526 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/flat_ast.h>
+#include <helion/pstate.h>
+#include <helion/resolve.h>
+#include <string.h>
+#include <stdexcept>
+
+using namespace helion;
+using namespace helion::ast;
+
+
+int64_t flat_module::integer(node_id n) const {
+  int64_t i;
+  memcpy(&i, &numbers[nodes[n].data], sizeof(i));
+  return i;
+}
+
+double flat_module::floating(node_id n) const {
+  double d;
+  memcpy(&d, &numbers[nodes[n].data], sizeof(d));
+  return d;
+}
+
+
+
+namespace {
+
+  class flattener {
+    flat_module &m;
+    // the tree node each flat node came from. A tree node remembers the id
+    // it was laid out at, and this confirms that the id is from this module
+    // so shared nodes are laid out once
+    std::vector<node *> origin;
+    // the children of every node being laid out, innermost last. A node's
+    // children are collected here before they're copied into the module, as
+    // laying them out appends their own children to the same array
+    std::vector<node_id> pending;
+
+    // `n` is the tree node this is laid out from, if it is one. Kinds that
+    // only exist in the flat form just borrow its location from `at`
+    node_id add(node_kind kind, node *n, node *at) {
+      node_id id = m.nodes.size();
+      flat_node f;
+      f.kind = kind;
+      if (at != nullptr) f.loc = at->first_token().loc;
+      m.nodes.push_back(f);
+      origin.push_back(n);
+      return id;
+    }
+
+    // move the children pending since `base` into the module
+    void set_children(node_id id, size_t base) {
+      m.nodes[id].first = m.children.size();
+      m.nodes[id].count = pending.size() - base;
+      m.children.insert(m.children.end(), pending.begin() + base, pending.end());
+      pending.resize(base);
+    }
+
+    inline void child(node *n) {
+      node_id id = lay_out(n);
+      pending.push_back(id);
+    }
+
+    template <typename T>
+    void append(const std::vector<T> &nodes) {
+      for (auto &n : nodes) child(n.get());
+    }
+
+   public:
+    flattener(flat_module &m) : m(m) {}
+
+    node_id lay_out(node *n) {
+      if (n == nullptr) return no_node;
+      if (n->flat_id < origin.size() && origin[n->flat_id] == n) return n->flat_id;
+
+      node_id id = add(n->kind, n, n);
+      n->flat_id = id;
+      size_t base = pending.size();
+      uint8_t flags = 0;
+      uint32_t data = 0, aux = 0;
+
+      switch (n->kind) {
+        case node_kind::number: {
+          auto *num = static_cast<number *>(n);
+          uint64_t bits;
+          if (num->type == number::floating) {
+            flags |= flat_floating;
+            memcpy(&bits, &num->as.floating, sizeof(bits));
+          } else {
+            memcpy(&bits, &num->as.integer, sizeof(bits));
+          }
+          data = m.numbers.size();
+          m.numbers.push_back(bits);
+          break;
+        }
+
+        case node_kind::binary_op: {
+          auto *op = static_cast<binary_op *>(n);
+          child(op->left.get());
+          child(op->right.get());
+          data = atom(op->op).id();
+          break;
+        }
+
+        case node_kind::dot: {
+          auto *d = static_cast<dot *>(n);
+          child(d->expr.get());
+          data = d->sub.id();
+          break;
+        }
+
+        case node_kind::subscript: {
+          auto *sub = static_cast<subscript *>(n);
+          child(sub->expr.get());
+          append(sub->subs);
+          break;
+        }
+
+        case node_kind::call: {
+          auto *c = static_cast<call *>(n);
+          child(c->func.get());
+          append(c->args);
+          break;
+        }
+
+        case node_kind::tuple:
+          append(static_cast<tuple *>(n)->vals);
+          break;
+
+        case node_kind::string:
+          data = m.texts.size();
+          m.texts.push_back(static_cast<string *>(n)->val);
+          break;
+
+        case node_kind::keyword:
+          data = m.texts.size();
+          m.texts.push_back(static_cast<keyword *>(n)->val);
+          break;
+
+        case node_kind::nil:
+          break;
+
+        case node_kind::do_block:
+          append(static_cast<do_block *>(n)->exprs);
+          break;
+
+        case node_kind::return_node: {
+          auto *r = static_cast<return_node *>(n);
+          if (r->val != nullptr) child(r->val.get());
+          break;
+        }
+
+        case node_kind::type_node: {
+          auto *t = static_cast<type_node *>(n);
+          if (t->constant) flags |= flat_constant;
+          if (t->parameter) flags |= flat_parameter;
+          data = t->name.id();
+          aux = (uint32_t)t->style;
+          append(t->params);
+          break;
+        }
+
+        case node_kind::var_decl: {
+          auto *d = static_cast<var_decl *>(n);
+          if (d->global) flags |= flat_global;
+          if (d->is_arg) flags |= flat_arg;
+          data = d->name.id();
+          aux = d->ind;
+          child(d->type.get());
+          child(d->value.get());
+          break;
+        }
+
+        case node_kind::var: {
+          auto *v = static_cast<var *>(n);
+          if (v->global) {
+            flags |= flat_global;
+            data = v->global_name.id();
+            aux = no_node;
+          } else {
+            data = v->decl->name.id();
+            aux = lay_out(v->decl.get());
+          }
+          break;
+        }
+
+        case node_kind::prototype: {
+          auto *p = static_cast<prototype *>(n);
+          child(p->type.get());
+          append(p->args);
+          break;
+        }
+
+        case node_kind::func: {
+          auto *f = static_cast<func *>(n);
+          f->parse_body();
+          if (f->anonymous) flags |= flat_anonymous;
+          child(f->proto.get());
+          append(f->stmts);
+          append(f->caputures);
+          aux = f->stmts.size();
+          break;
+        }
+
+        case node_kind::def: {
+          auto *d = static_cast<def *>(n);
+          data = d->name.id();
+          child(d->fn.get());
+          break;
+        }
+
+        case node_kind::if_node: {
+          auto *i = static_cast<if_node *>(n);
+          if (i->has_default) flags |= flat_default;
+          for (auto &c : i->conds) {
+            node_id cid = add(node_kind::if_condition, nullptr, c.cond.get());
+            size_t cbase = pending.size();
+            child(c.cond.get());
+            append(c.body);
+            set_children(cid, cbase);
+            pending.push_back(cid);
+          }
+          break;
+        }
+
+        case node_kind::typedef_node: {
+          auto *t = static_cast<typedef_node *>(n);
+          if (t->value) flags |= flat_value;
+          child(t->type.get());
+          child(t->extends.get());
+          for (auto &f : t->fields) {
+            node_id fid = add(node_kind::field, nullptr, f.type.get());
+            m.nodes[fid].data = f.name.id();
+            size_t fbase = pending.size();
+            child(f.type.get());
+            set_children(fid, fbase);
+            pending.push_back(fid);
+          }
+          append(t->defs);
+          aux = t->fields.size();
+          break;
+        }
+
+        case node_kind::typeassert: {
+          auto *a = static_cast<typeassert *>(n);
+          child(a->val.get());
+          child(a->type.get());
+          break;
+        }
+
+        default:
+          throw std::logic_error("unknown ast node kind in flatten");
+      }
+
+      m.nodes[id].flags = flags;
+      m.nodes[id].data = data;
+      m.nodes[id].aux = aux;
+      set_children(id, base);
+      return id;
+    }
+  };
+
+}  // namespace
+
+
+
+flat_module ast::flatten(module &mod) {
+  flat_module m;
+  flattener f(m);
+  for (auto &t : mod.typedefs) m.typedefs.push_back(f.lay_out(t.get()));
+  for (auto &d : mod.defs) m.defs.push_back(f.lay_out(d.get()));
+  m.entry = f.lay_out(mod.entry.get());
+  return m;
+}
+
+
+
+namespace {
+
+  class unflattener {
+    const flat_module &m;
+    // the tree node built for each flat node, so shared nodes stay shared
+    std::vector<std::shared_ptr<node>> built;
+    node_id entry_fn;
+
+    template <typename T>
+    std::shared_ptr<T> make(node_id id, scope *sc) {
+      auto n = std::make_shared<T>(sc);
+      token t;
+      t.loc = m.nodes[id].loc;
+      n->set_bounds(t, t);
+      built[id] = n;
+      return n;
+    }
+
+    template <typename T = node>
+    std::shared_ptr<T> get(node_id id, scope *sc) {
+      if (id == no_node) return nullptr;
+      return std::static_pointer_cast<T>(build(id, sc));
+    }
+
+    template <typename T>
+    void append(std::vector<std::shared_ptr<T>> &out, const node_id *begin,
+                const node_id *end, scope *sc) {
+      for (auto *c = begin; c != end; c++) out.push_back(get<T>(*c, sc));
+    }
+
+   public:
+    unflattener(const flat_module &m) : m(m), built(m.nodes.size()) {
+      entry_fn = m.entry != no_node ? m.child(m.entry, 0) : no_node;
+    }
+
+    std::shared_ptr<node> build(node_id id, scope *sc) {
+      if (built[id] != nullptr) return built[id];
+
+      auto &f = m.nodes[id];
+      auto *c = m.child_begin(id);
+      auto *e = m.child_end(id);
+
+      switch (f.kind) {
+        case node_kind::number: {
+          auto n = make<number>(id, sc);
+          if (f.flags & flat_floating) {
+            n->type = number::floating;
+            n->as.floating = m.floating(id);
+          } else {
+            n->type = number::integer;
+            n->as.integer = m.integer(id);
+          }
+          return n;
+        }
+
+        case node_kind::binary_op: {
+          auto n = make<binary_op>(id, sc);
+          n->op = std::string(m.name(id).view());
+          n->left = get(c[0], sc);
+          n->right = get(c[1], sc);
+          return n;
+        }
+
+        case node_kind::dot: {
+          auto n = make<dot>(id, sc);
+          n->sub = m.name(id);
+          n->expr = get(c[0], sc);
+          return n;
+        }
+
+        case node_kind::subscript: {
+          auto n = make<subscript>(id, sc);
+          n->expr = get(c[0], sc);
+          append(n->subs, c + 1, e, sc);
+          return n;
+        }
+
+        case node_kind::call: {
+          auto n = make<call>(id, sc);
+          n->func = get(c[0], sc);
+          append(n->args, c + 1, e, sc);
+          return n;
+        }
+
+        case node_kind::tuple: {
+          auto n = make<tuple>(id, sc);
+          append(n->vals, c, e, sc);
+          return n;
+        }
+
+        case node_kind::string: {
+          auto n = make<string>(id, sc);
+          n->val = m.value(id);
+          return n;
+        }
+
+        case node_kind::keyword: {
+          auto n = make<keyword>(id, sc);
+          n->val = m.value(id);
+          return n;
+        }
+
+        case node_kind::nil:
+          return make<nil>(id, sc);
+
+        case node_kind::do_block: {
+          auto n = make<do_block>(id, sc);
+          append(n->exprs, c, e, sc->spawn());
+          return n;
+        }
+
+        case node_kind::return_node: {
+          auto n = make<return_node>(id, sc);
+          if (c != e) n->val = get(c[0], sc);
+          return n;
+        }
+
+        case node_kind::type_node: {
+          auto n = make<type_node>(id, sc);
+          n->constant = f.flags & flat_constant;
+          n->parameter = f.flags & flat_parameter;
+          n->name = m.name(id);
+          n->style = (type_style)f.aux;
+          append(n->params, c, e, sc);
+          return n;
+        }
+
+        case node_kind::var_decl: {
+          auto n = make<var_decl>(id, sc);
+          n->global = f.flags & flat_global;
+          n->is_arg = f.flags & flat_arg;
+          n->name = m.name(id);
+          n->type = get<type_node>(c[0], sc);
+          n->value = get(c[1], sc);
+          sc->bind(n->name, n);
+          return n;
+        }
+
+        case node_kind::var: {
+          auto n = make<var>(id, sc);
+          if (f.flags & flat_global) {
+            n->global = true;
+            n->global_name = m.name(id);
+          } else {
+            n->decl = get<var_decl>(f.aux, sc);
+          }
+          return n;
+        }
+
+        case node_kind::prototype: {
+          auto n = make<prototype>(id, sc);
+          n->type = get<type_node>(c[0], sc);
+          append(n->args, c + 1, e, sc);
+          return n;
+        }
+
+        case node_kind::func: {
+          // the entry's statements are the top level, which is the module's
+          // scope. Every other function gets a scope of its own
+          auto n = make<func>(id, sc);
+          scope *body = sc;
+          if (id != entry_fn) {
+            body = sc->spawn();
+            body->fn = n;
+            n->scp = body;
+          }
+          n->anonymous = f.flags & flat_anonymous;
+          n->proto = get<prototype>(c[0], body);
+          append(n->stmts, c + 1, c + 1 + f.aux, body);
+          append(n->caputures, c + 1 + f.aux, e, body);
+          return n;
+        }
+
+        case node_kind::def: {
+          auto n = make<def>(id, sc);
+          n->name = m.name(id);
+          n->fn = get<func>(c[0], sc);
+          return n;
+        }
+
+        case node_kind::if_node: {
+          auto n = make<if_node>(id, sc);
+          n->has_default = f.flags & flat_default;
+          for (; c != e; c++) {
+            scope *ns = sc->spawn();
+            if_node::condition cond;
+            cond.cond = get(m.child(*c, 0), ns);
+            append(cond.body, m.child_begin(*c) + 1, m.child_end(*c), ns);
+            n->conds.push_back(std::move(cond));
+          }
+          return n;
+        }
+
+        case node_kind::typedef_node: {
+          auto n = make<typedef_node>(id, sc);
+          n->value = f.flags & flat_value;
+          n->type = get<type_node>(c[0], sc);
+          n->extends = get<type_node>(c[1], sc);
+          for (uint32_t i = 0; i < f.aux; i++) {
+            node_id field = c[2 + i];
+            typedef_node::field_t ft;
+            ft.name = m.name(field);
+            ft.type = get<type_node>(m.child(field, 0), sc);
+            n->fields.push_back(ft);
+          }
+          append(n->defs, c + 2 + f.aux, e, sc);
+          return n;
+        }
+
+        case node_kind::typeassert: {
+          auto n = make<typeassert>(id, sc);
+          n->val = get(c[0], sc);
+          n->type = get<type_node>(c[1], sc);
+          return n;
+        }
+
+        default:
+          throw std::logic_error("unknown flat node kind in unflatten");
+      }
+    }
+  };
+
+}  // namespace
+
+
+
+std::unique_ptr<ast::module> ast::unflatten(const flat_module &m) {
+  auto mod = std::make_unique<module>();
+  scope *sc = mod->get_scope();
+  sc->global = true;
+
+  // the top level statements go first, so a def that uses a top level
+  // variable finds its declaration already bound in the module's scope
+  unflattener u(m);
+  if (m.entry != no_node) {
+    mod->entry = std::static_pointer_cast<def>(u.build(m.entry, sc));
+    sc->fn = mod->entry->fn;
+  }
+  for (auto id : m.typedefs) {
+    auto t = u.build(id, sc);
+    mod->typedefs.push_back(std::static_pointer_cast<typedef_node>(t));
+  }
+  for (auto id : m.defs)
+    mod->defs.push_back(std::static_pointer_cast<def>(u.build(id, sc)));
+  resolve(*mod);
+  return mod;
+}
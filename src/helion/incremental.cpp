@@ -0,0 +1,390 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/incremental.h>
+#include <helion/resolve.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+using namespace helion;
+
+
+static pstate skip_terms(pstate s) {
+  while (s.kind() == tok_term) s++;
+  return s;
+}
+
+
+namespace {
+
+  // moves the locations of nodes that were parsed from the version of the
+  // source before an edit over to the version after it. A kept form is
+  // either all before the edit or all after it, so each token just moves
+  // along with the bytes around it. Tokens that aren't in the old version
+  // are left alone, so shared nodes can be seen twice
+  class relocator {
+    source_file *from, *to;
+    size_t edit_end;
+    ptrdiff_t shift;
+
+    token move(token t) {
+      if (!from->contains(t.loc)) return t;
+      size_t off = from->offset(t.loc);
+      if (off >= edit_end) off += shift;
+      t.offset = off;
+      t.loc = to->loc(off);
+      return t;
+    }
+
+    template <typename T>
+    void walk(const std::vector<T> &nodes) {
+      for (auto &n : nodes) walk(n.get());
+    }
+
+   public:
+    relocator(source_file *from, source_file *to, size_t offset,
+              size_t removed, size_t inserted)
+        : from(from),
+          to(to),
+          edit_end(offset + removed),
+          shift((ptrdiff_t)inserted - (ptrdiff_t)removed) {}
+
+    void walk(ast::node *n) {
+      using namespace ast;
+      if (n == nullptr) return;
+      n->set_bounds(move(n->first_token()), move(n->last_token()));
+
+      switch (n->kind) {
+        case node_kind::binary_op: {
+          auto *op = static_cast<binary_op *>(n);
+          walk(op->left.get());
+          walk(op->right.get());
+          break;
+        }
+
+        case node_kind::dot:
+          walk(static_cast<dot *>(n)->expr.get());
+          break;
+
+        case node_kind::subscript: {
+          auto *sub = static_cast<subscript *>(n);
+          walk(sub->expr.get());
+          walk(sub->subs);
+          break;
+        }
+
+        case node_kind::call: {
+          auto *c = static_cast<call *>(n);
+          walk(c->func.get());
+          walk(c->args);
+          break;
+        }
+
+        case node_kind::tuple:
+          walk(static_cast<tuple *>(n)->vals);
+          break;
+
+        case node_kind::do_block:
+          walk(static_cast<do_block *>(n)->exprs);
+          break;
+
+        case node_kind::return_node:
+          walk(static_cast<return_node *>(n)->val.get());
+          break;
+
+        case node_kind::type_node:
+          walk(static_cast<type_node *>(n)->params);
+          break;
+
+        case node_kind::var_decl: {
+          auto *d = static_cast<var_decl *>(n);
+          walk(d->type.get());
+          walk(d->value.get());
+          break;
+        }
+
+        case node_kind::prototype: {
+          auto *p = static_cast<prototype *>(n);
+          walk(p->args);
+          walk(p->type.get());
+          break;
+        }
+
+        case node_kind::func: {
+          auto *f = static_cast<func *>(n);
+          walk(f->proto.get());
+          walk(f->stmts);
+          break;
+        }
+
+        case node_kind::def:
+          walk(static_cast<def *>(n)->fn.get());
+          break;
+
+        case node_kind::if_node:
+          for (auto &c : static_cast<if_node *>(n)->conds) {
+            walk(c.cond.get());
+            walk(c.body);
+          }
+          break;
+
+        case node_kind::typedef_node: {
+          auto *t = static_cast<typedef_node *>(n);
+          walk(t->type.get());
+          walk(t->extends.get());
+          for (auto &f : t->fields) walk(f.type.get());
+          walk(t->defs);
+          break;
+        }
+
+        case node_kind::typeassert: {
+          auto *a = static_cast<typeassert *>(n);
+          walk(a->val.get());
+          walk(a->type.get());
+          break;
+        }
+
+        // a var's declaration is walked where it's declared
+        case node_kind::var:
+        case node_kind::number:
+        case node_kind::string:
+        case node_kind::keyword:
+        case node_kind::nil:
+          break;
+
+        default:
+          throw std::logic_error("unknown ast node kind in relocate");
+      }
+    }
+  };
+
+}  // namespace
+
+
+
+incremental_parser::incremental_parser(source_file *file) : m_file(file) {
+  m_module = std::make_unique<ast::module>();
+  scope *sc = m_module->get_scope();
+  sc->global = true;
+
+  auto entry = std::make_shared<ast::def>(sc);
+  entry->fn = std::make_shared<ast::func>(sc);
+  // impossible function name
+  entry->name = "#entry";
+  m_module->entry = entry;
+
+  // nothing to keep from a previous parse
+  token_splice none;
+  reparse(std::make_shared<tokenizer>(file), none);
+}
+
+
+incremental_parser::~incremental_parser() {
+  // the module is going away too, so nothing points into them anymore
+  auto &mgr = source_manager::global();
+  if (m_owns_file) mgr.remove(m_file);
+  if (m_range != 0) mgr.release(m_range);
+}
+
+
+
+reparse_result incremental_parser::edit(size_t offset, size_t removed,
+                                        std::string_view inserted) {
+  auto &buf = *m_file->buffer();
+  if (offset > buf.size() || removed > buf.size() - offset)
+    throw std::out_of_range("edit is outside of the source");
+
+  std::string src;
+  src.reserve(buf.size() - removed + inserted.size());
+  src.append(buf.data(), offset);
+  src.append(inserted);
+  src.append(buf.data() + offset + removed, buf.size() - offset - removed);
+
+  // the edited source goes in the half of the range the current version
+  // isn't in, unless it's outgrown it. Then it moves to a new range, with
+  // room to grow for a while
+  auto &mgr = source_manager::global();
+  size_t span = src.size() + 1;
+  source_loc range = m_range;
+  size_t half = m_half;
+  bool side = !m_side;
+  if (span > half) {
+    half = span * 2;
+    range = mgr.reserve(half * 2);
+    side = false;
+  }
+  auto edited =
+      source_manager::make(source_buffer::from_string(std::move(src)),
+                           m_file->path(), range + (side ? half : 0));
+
+  // it's only registered once it parsed, so a failed edit leaves nothing
+  // behind
+  token_splice splice;
+  reparse_result res;
+  try {
+    auto tokens = std::make_shared<tokenizer>(
+        *m_tokens, edited.get(), offset, removed, inserted.size(), splice);
+    res = reparse(tokens, splice);
+  } catch (...) {
+    if (range != m_range) mgr.release(range);
+    throw;
+  }
+
+  source_file *old = m_file;
+  m_file = mgr.adopt(std::move(edited));
+
+  // the forms that were kept still point into the old version
+  relocator r(old, m_file, offset, removed, inserted.size());
+  for (auto &f : m_forms) {
+    if (!f.stale) continue;
+    for (auto &n : f.nodes) r.walk(n.get());
+    f.stale = false;
+  }
+
+  if (m_owns_file) mgr.remove(old);
+  if (range != m_range && m_range != 0) mgr.release(m_range);
+  m_owns_file = true;
+  m_range = range;
+  m_half = half;
+  m_side = side;
+  return res;
+}
+
+
+
+reparse_result incremental_parser::reparse(std::shared_ptr<tokenizer> tokens,
+                                           const token_splice &splice) {
+  scope *sc = m_module->get_scope();
+  reparse_result res;
+
+  // where an old form starts in the new token stream, or -1 if it looked at
+  // a token that was lexed again
+  ptrdiff_t moved = splice.suffix_new - splice.suffix_old;
+  auto first_of = [&](const form &f) -> size_t {
+    if (f.seen < splice.prefix) return f.first;
+    if (splice.suffix_old != (size_t)-1 && f.first >= splice.suffix_old)
+      return f.first + moved;
+    return -1;
+  };
+
+  // the names bound at the top level by forms that were dropped or parsed
+  // again. Later forms that looked them up have to be parsed again too
+  std::unordered_set<atom> changed;
+  auto depends = [&](const form &f) {
+    if (changed.empty()) return false;
+    for (auto &name : f.trace.lookups)
+      if (changed.count(name) != 0) return true;
+    return false;
+  };
+
+  std::vector<form> forms;
+  forms.reserve(m_forms.size());
+  std::vector<bool> kept(m_forms.size(), false);
+
+  // the top level is parsed with the bindings of the forms before it, like
+  // a full parse, and scopes spawned from it don't know about the entry
+  sc->fn = nullptr;
+  sc->unbind_all();
+
+  try {
+    pstate s(tokens, 0);
+    size_t next = 0;
+    while (true) {
+      s = skip_terms(s);
+      if (s.kind() == tok_eof) break;
+      size_t at = s.index();
+
+      // old forms that start before here can't be kept anymore
+      for (; next < m_forms.size(); next++) {
+        size_t first = first_of(m_forms[next]);
+        if (first != (size_t)-1 && first >= at) break;
+        for (auto &b : m_forms[next].trace.binds) changed.insert(b->name);
+      }
+
+      if (next < m_forms.size() && first_of(m_forms[next]) == at &&
+          !depends(m_forms[next])) {
+        form f = m_forms[next];
+        uint32_t by = at - f.first;
+        f.first += by;
+        f.end += by;
+        f.seen += by;
+        f.stale = true;
+        for (auto &b : f.trace.binds) sc->bind(b->name, b);
+        kept[next++] = true;
+        res.reused++;
+        s = s.at(f.end);
+        forms.push_back(std::move(f));
+        continue;
+      }
+
+      form f;
+      f.first = at;
+      tokens->furthest = at;
+      sc->trace = &f.trace;
+      auto r = parse_top_level(s, sc);
+      sc->trace = nullptr;
+      f.end = r.state.index();
+      f.seen = tokens->furthest;
+      f.nodes = r.vals;
+
+      // a def looks up the same globals over and over
+      auto &names = f.trace.lookups;
+      std::sort(names.begin(), names.end(),
+                [](atom a, atom b) { return a.id() < b.id(); });
+      names.erase(std::unique(names.begin(), names.end()), names.end());
+
+      for (auto &b : f.trace.binds) changed.insert(b->name);
+      res.changed.insert(res.changed.end(), f.nodes.begin(), f.nodes.end());
+      s = r.state;
+      forms.push_back(std::move(f));
+    }
+  } catch (...) {
+    // drop the scopes this parse spawned and put the old bindings back
+    sc->trace = nullptr;
+    std::unordered_set<scope *> old;
+    for (auto &f : m_forms)
+      old.insert(f.trace.spawned.begin(), f.trace.spawned.end());
+    sc->take_children([&](scope *c) { return old.count(c) == 0; });
+    sc->unbind_all();
+    for (auto &f : m_forms)
+      for (auto &b : f.trace.binds) sc->bind(b->name, b);
+    sc->fn = m_module->entry->fn;
+    throw;
+  }
+
+  std::unordered_set<scope *> dead;
+  for (size_t i = 0; i < m_forms.size(); i++) {
+    if (kept[i]) continue;
+    auto &f = m_forms[i];
+    res.removed.insert(res.removed.end(), f.nodes.begin(), f.nodes.end());
+    dead.insert(f.trace.spawned.begin(), f.trace.spawned.end());
+  }
+  if (!dead.empty())
+    res.scopes =
+        sc->take_children([&](scope *c) { return dead.count(c) != 0; });
+
+  m_forms = std::move(forms);
+  m_tokens = tokens;
+  sc->fn = m_module->entry->fn;
+
+  m_module->typedefs.clear();
+  m_module->defs.clear();
+  auto &stmts = m_module->entry->fn->stmts;
+  stmts.clear();
+  for (auto &f : m_forms) {
+    for (auto &v : f.nodes) {
+      if (auto tn = ast::dyn_cast<ast::typedef_node>(v); tn) {
+        m_module->typedefs.push_back(tn);
+      } else if (auto tn = ast::dyn_cast<ast::def>(v); tn) {
+        m_module->defs.push_back(tn);
+      } else {
+        stmts.push_back(v);
+      }
+    }
+  }
+
+  // the entry's frame is laid out again, reusing the slots of removed forms
+  ast::resolve_edit(*m_module, res.changed);
+  return res;
+}
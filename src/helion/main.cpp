@@ -1,16 +1,19 @@
 // [License]
 // MIT - See LICENSE.md file in the package.
 
+#include <dirent.h>
 #include <gc/gc.h>
 #include <helion.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <uv.h>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <regex>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
@@ -27,6 +30,45 @@ using namespace std::string_literals;
 extern "C" void GC_allow_register_threads();
 
 
+/**
+ * add every helion source file under a directory to `out`, recursively.
+ * Returns false if the directory couldn't be read
+ */
+static bool find_sources(const std::string &dir, std::vector<std::string> &out) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) return false;
+  while (struct dirent *ent = readdir(d)) {
+    std::string name = ent->d_name;
+    if (name == "." || name == "..") continue;
+    std::string path = dir + "/" + name;
+    struct stat sinfo;
+    if (stat(path.c_str(), &sinfo) != 0) continue;
+    if (S_ISDIR(sinfo.st_mode)) {
+      find_sources(path, out);
+    } else if (name.size() > 3 && name.compare(name.size() - 3, 3, ".he") == 0) {
+      out.push_back(path);
+    }
+  }
+  closedir(d);
+  return true;
+}
+
+
+/**
+ * the sexpr form of a module, with inferred type parameters left unnumbered.
+ * A lazily parsed body numbers its own after the rest of the module, so
+ * only those differ between a lazy and an eager parse that otherwise match
+ */
+static std::string check_form(ast::module &m) {
+  std::string s;
+  llvm::raw_string_ostream out(s);
+  ast::print(out, m, ast::print_format::sexpr);
+  out.flush();
+  static const std::regex inferred("Inferred_[0-9]+");
+  return std::regex_replace(s, inferred, "Inferred");
+}
+
+
 int main(int argc, char **argv) {
   CLI::App app;
   std::string driver_path = ":NONE";
@@ -35,36 +77,156 @@ int main(int argc, char **argv) {
   app.add_option("-d,--driver_opts", driver_opts,
                  "options to pass into the driver");
 
-  std::string entry_point;
-  auto file_opt = app.add_option("entry point", entry_point, "the entry file");
+  std::vector<std::string> inputs;
+  auto file_opt = app.add_option(
+      "entry point", inputs,
+      "the entry file, or several files or directories to parse as one module");
   file_opt->required(true);
 
+  bool bench_lex = false;
+  app.add_flag("--bench-lex", bench_lex,
+               "tokenize the entry file and report tokens per second");
+
+  bool lazy_defs = false;
+  app.add_flag("--lazy-defs", lazy_defs,
+               "skip def bodies while parsing, and parse them when needed");
+
+  bool check_lazy = false;
+  app.add_flag("--check-lazy", check_lazy,
+               "parse the entry file with and without --lazy-defs, and check "
+               "that they come out the same");
+
+  bool stream_tokens = false;
+  app.add_flag("--stream-tokens", stream_tokens,
+               "only keep the tokens of the top level form being parsed");
+
+  std::string cache_dir;
+  app.add_option("--ast-cache", cache_dir,
+                 "directory to keep parsed files in, to skip parsing them "
+                 "again while they're unchanged");
+
+  std::string ast_format = "source";
+  app.add_option("--ast-format", ast_format,
+                 "how to print the parsed module: source, sexpr or json")
+      ->check(CLI::IsMember({"source", "sexpr", "json"}));
+
+  bool no_reorder = false;
+  app.add_flag("--no-reorder-fields", no_reorder,
+               "lay object fields out in the order they're declared");
+
+  bool layout_report = false;
+  app.add_flag("--layout-report", layout_report,
+               "report how object types were laid out, and the bytes saved");
+
   app.allow_extras(true);
 
   CLI11_PARSE(app, argc, argv);
+  // skipped bodies are parsed from their tokens later, so those are kept
+  if (stream_tokens && lazy_defs) {
+    puts("--stream-tokens can't be used with --lazy-defs");
+    return 1;
+  }
+  helion::reorder_fields = !no_reorder;
 
   // start the garbage collector
   GC_INIT();
   GC_allow_register_threads();
   helion::init();
 
-  const char *ep_ptr = entry_point.c_str();
+  // expand directories into the sources under them. Files found in a
+  // directory are sorted so the merged module doesn't depend on readdir order
+  std::vector<std::string> paths;
+  for (auto &in : inputs) {
+    // check that the file exists before trying to read it
+    struct stat sinfo;
+    if (stat(in.c_str(), &sinfo) != 0) {
+      puts("Unable to open file", in);
+      return 1;
+    }
+    if (S_ISDIR(sinfo.st_mode)) {
+      std::vector<std::string> found;
+      if (!find_sources(in, found)) {
+        puts("Unable to read directory", in);
+        return 1;
+      }
+      std::sort(found.begin(), found.end());
+      paths.insert(paths.end(), found.begin(), found.end());
+    } else {
+      paths.push_back(in);
+    }
+  }
 
-  // check that the file exists before trying to read it
-  struct stat sinfo;
-  int sres = stat(ep_ptr, &sinfo);
-  if (sres != 0) {
-    puts("Unable to open file", entry_point);
+  if (paths.empty()) {
+    puts("No source files found");
     return 1;
   }
 
-  // print every token from the file
-  text src = read_file(ep_ptr);
+  // map the files in directly, the tokenizer works on the raw utf8 bytes
+  std::vector<source_file *> files;
+  for (auto &path : paths) {
+    auto file = source_manager::global().load(path);
+    if (file == nullptr) {
+      puts("Unable to read file", path);
+      return 1;
+    }
+    files.push_back(file);
+  }
+  auto file = files[0];
+  auto src = file->buffer();
+
+  if (bench_lex) {
+    auto start = std::chrono::steady_clock::now();
+    tokenizer toks(file);
+    size_t count = 0;
+    while (toks.kind(count) != tok_eof) count++;
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    printf("%zu tokens in %fs (%.0f tokens/sec, %.1f MB/sec, %s scanner)\n",
+           count, secs.count(), count / secs.count(),
+           src->size() / secs.count() / 1e6, scan::impl_name());
+    return 0;
+  }
+
+  if (check_lazy) {
+    auto eager = parse_module(file);
+    auto lazy = parse_module(file, true);
+    // flattening parses every body that was skipped
+    ast::flatten(*lazy);
+    std::string a = check_form(*eager), b = check_form(*lazy);
+    if (a != b) {
+      size_t at = std::mismatch(a.begin(), a.end(), b.begin(), b.end()).first -
+                  a.begin();
+      size_t from = at < 40 ? 0 : at - 40;
+      puts("lazy and eager parses differ at byte", at);
+      puts("  eager:", a.substr(from, 120));
+      puts("  lazy: ", b.substr(from, 120));
+      return 1;
+    }
+    puts("lazy and eager parses match");
+    return 0;
+  }
+
+  std::unique_ptr<ast_cache> cache;
+  if (!cache_dir.empty()) cache = std::make_unique<ast_cache>(cache_dir);
 
   try {
-    auto res = parse_module(src, entry_point);
-    puts(res->str());
+    std::unique_ptr<ast::module> res;
+    if (files.size() > 1)
+      res = parse_modules(files, thread_pool::global(), lazy_defs,
+                          cache.get(), stream_tokens);
+    else if (cache != nullptr)
+      res = cache->parse(file, stream_tokens);
+    else
+      res = parse_module(file, lazy_defs, stream_tokens);
+    // written as the tree is walked, rather than built up as one string
+    auto format = ast_format == "json"    ? ast::print_format::json
+                  : ast_format == "sexpr" ? ast::print_format::sexpr
+                                          : ast::print_format::source;
+    ast::print(llvm::outs(), *res, format);
+    llvm::outs() << "\n";
+    llvm::outs().flush();
     compile_module(std::move(res));
+    if (layout_report) print_layout_report(llvm::errs());
   } catch (syntax_error &e) {
     puts(e.what());
   }
@@ -2,30 +2,36 @@
 // MIT - See LICENSE.md file in the package.
 
 #include <helion/ast.h>
+#include <helion/ast_cache.h>
 #include <helion/parser.h>
+#include <helion/pcomb.h>
 #include <helion/pstate.h>
+#include <helion/resolve.h>
 #include <atomic>
-#include <map>
+#include <exception>
+#include <future>
+#include <mutex>
 
 
 
 
 using namespace helion;
 
+// precedence and associativity of the binary operators
+#include <helion/binary_ops.inc>
 
-static std::atomic<int> next_type_num;
 
-
-static text get_next_param_name(void) {
-  text name = "Inferred_";
-  name += std::to_string(next_type_num++);
+// numbered in the module the parameter is in
+static atom get_next_param_name(scope *s) {
+  std::string name = "Inferred_";
+  name += std::to_string(s->take_type_num());
   return name;
 }
 
 
 static std::shared_ptr<ast::type_node> get_next_param_type(scope *s) {
   auto t = std::make_shared<ast::type_node>(s);
-  t->name = get_next_param_name();
+  t->name = get_next_param_name(s);
   t->parameter = true;
   return t;
 }
@@ -47,7 +53,6 @@ scope *ast::module::get_scope(void) { return m_scope.get(); }
 #define ADD_PARSER(name) static presult parse_##name(pstate, scope *);
 ADD_PARSER(num);
 ADD_PARSER(var);
-ADD_PARSER(paren);
 ADD_PARSER(str);
 ADD_PARSER(keyword);
 ADD_PARSER(do);
@@ -59,19 +64,63 @@ static presult parse_binary_rhs(pstate s, scope *, int expr_prec,
                                 rc<ast::node> lhs);
 static presult expand_expression(presult, scope *);
 static presult parse_function_args(pstate, scope *);
-static presult parse_function_literal(pstate, scope *);
 static presult parse_return(pstate, scope *);
 static presult parse_if(pstate, scope *);
 static presult parse_typedef(pstate, scope *);
 static presult parse_let(pstate, scope *);
 
-static presult parse_type(pstate s, scope *sc);
+
+
+/**
+ * packrat memoization. parse_expr tries a function literal before falling
+ * back to a parenthesized expression, and lets and prototypes speculatively
+ * parse types, so these rules are the ones that can be asked about the same
+ * token more than once. Failures are recorded in the tokenizer's memo and
+ * replayed, so a failing rule runs at most once per (position, scope). Rules
+ * that throw aren't recorded, as the syntax error ends the parse anyway
+ */
+enum memo_rule : uint64_t {
+  memo_type,
+  memo_prototype,
+  memo_function_literal,
+  memo_paren,
+};
+
+template <typename Fn>
+static presult memoized(memo_rule rule, pstate s, scope *sc, Fn fn) {
+  tokenizer *t = s.tokens();
+  if (t == nullptr || !t->memoize) return fn(s, sc);
+
+  uint64_t key = ((uint64_t)rule << 32) | (uint32_t)s.index();
+  auto it = t->memo.find(key);
+  if (it != t->memo.end() && it->second.scope == sc) {
+    return pfail(s.at(it->second.end));
+  }
+
+  auto r = fn(s, sc);
+  if (!r) {
+    // a success is consumed by whoever asked for it, so only failures are
+    // ever asked about again. Not keeping successes keeps the table small
+    t->memo[key] = {sc, (uint32_t)r.state.index()};
+  }
+  return r;
+}
+
+#define MEMO_PARSER(name)                                     \
+  static presult parse_##name##_rule(pstate, scope *);       \
+  static presult parse_##name(pstate s, scope *sc) {          \
+    return memoized(memo_##name, s, sc, parse_##name##_rule); \
+  }
+MEMO_PARSER(type);
+MEMO_PARSER(prototype);
+MEMO_PARSER(function_literal);
+MEMO_PARSER(paren);
 
 
 
 
 static auto glob_term(pstate s) {
-  while (s.first().type == tok_term) {
+  while (s.kind() == tok_term) {
     s = s.next();
   }
   return s;
@@ -95,36 +144,35 @@ std::unique_ptr<ast::module> helion::parse_module(pstate s) {
     // every time a top level expr is parsed, the scope
     // is reset to the top level scope
     s = glob_term(s);
-    if (s.first().type == tok_eof) break;
+    // the parser never backtracks out of a top level form
+    if (s.tokens() != nullptr) s.tokens()->commit(s.index());
+    if (s.kind() == tok_eof) break;
     // while we can, parse a statement
-    if (auto r = parse_expr(s, mod->get_scope()); r) {
-      // inherit the state from the parser. This allows us to pick up right
-      // after the end of the last parse_expr
-      s = r.state;
-      for (auto v : r.vals) {
-        if (auto tn = std::dynamic_pointer_cast<ast::typedef_node>(v); tn) {
-          mod->typedefs.push_back(tn);
-        } else if (auto tn = std::dynamic_pointer_cast<ast::def>(v); tn) {
-          mod->defs.push_back(tn);
-        } else {
-          stmts.push_back(v);
-        }
-      }
-
-      // bool found = false;
-      while (true) {
-        if (token end = s; end.type == tok_term) {
-          s++;
-          // found = true;
-        } else
-          break;
+    auto r = parse_top_level(s, mod->get_scope());
+    // inherit the state from the parser. This allows us to pick up right
+    // after the end of the last parse_expr
+    s = r.state;
+    for (auto v : r.vals) {
+      if (auto tn = ast::dyn_cast<ast::typedef_node>(v); tn) {
+        mod->typedefs.push_back(tn);
+      } else if (auto tn = ast::dyn_cast<ast::def>(v); tn) {
+        mod->defs.push_back(tn);
+      } else {
+        stmts.push_back(v);
       }
+    }
 
-      if (s.first().type == tok_eof) {
+    // bool found = false;
+    while (true) {
+      if (token end = s; end.type == tok_term) {
+        s++;
+        // found = true;
+      } else
         break;
-      }
-    } else {
-      throw syntax_error(s, "unexpected token");
+    }
+
+    if (s.kind() == tok_eof) {
+      break;
     }
   }
 
@@ -141,10 +189,18 @@ std::unique_ptr<ast::module> helion::parse_module(pstate s) {
 
   mod->entry = entry;
 
+  ast::resolve(*mod);
   return mod;
 }
 
 
+presult helion::parse_top_level(pstate s, scope *sc) {
+  auto r = parse_expr(s, sc);
+  if (!r) throw syntax_error(s, "unexpected token");
+  return r;
+}
+
+
 /**
  * wrapper that creates a state around text
  */
@@ -155,6 +211,82 @@ std::unique_ptr<ast::module> helion::parse_module(text s, text pth) {
 }
 
 
+/**
+ * wrapper that tokenizes a utf8 source buffer in place (ie: a mapped file)
+ */
+std::unique_ptr<ast::module> helion::parse_module(
+    std::shared_ptr<source_buffer> buf, text pth) {
+  auto t = std::make_shared<tokenizer>(buf, pth);
+  pstate state(t, 0);
+  return parse_module(state);
+}
+
+
+/**
+ * wrapper for a file that is already loaded into the source_manager
+ */
+std::unique_ptr<ast::module> helion::parse_module(source_file *file,
+                                                  bool lazy_bodies,
+                                                  bool streaming) {
+  auto t = std::make_shared<tokenizer>(file);
+  t->lazy_bodies = lazy_bodies;
+  t->streaming = streaming;
+  pstate state(t, 0);
+  return parse_module(state);
+}
+
+
+
+std::unique_ptr<ast::module> helion::parse_modules(
+    const std::vector<source_file *> &files, thread_pool &pool,
+    bool lazy_bodies, ast_cache *cache, bool streaming) {
+  if (files.empty()) return parse_module(text(), text());
+
+  std::vector<std::future<std::unique_ptr<ast::module>>> parsed;
+  for (auto *f : files) {
+    parsed.push_back(pool.submit([f, lazy_bodies, cache, streaming] {
+      if (cache != nullptr) return cache->parse(f, streaming);
+      return parse_module(f, lazy_bodies, streaming);
+    }));
+  }
+
+  // wait on every file even after one failed, so nothing is still running
+  // on the pool when the error is thrown
+  std::unique_ptr<ast::module> mod;
+  std::exception_ptr err;
+  for (auto &p : parsed) {
+    try {
+      auto m = p.get();
+      if (err) continue;
+      if (mod == nullptr)
+        mod = std::move(m);
+      else
+        mod->merge(std::move(m));
+    } catch (...) {
+      if (!err) err = std::current_exception();
+    }
+  }
+  if (err) std::rethrow_exception(err);
+  return mod;
+}
+
+
+void ast::module::merge(std::unique_ptr<module> other) {
+  for (auto &t : other->typedefs) typedefs.push_back(t);
+  for (auto &d : other->defs) defs.push_back(d);
+  for (auto &s : other->stmts) stmts.push_back(s);
+  if (other->entry != nullptr) {
+    auto &into = entry->fn->stmts;
+    auto &from = other->entry->fn->stmts;
+    into.insert(into.end(), from.begin(), from.end());
+    // their locals move into this entry's frame
+    ast::resolve(*this, from);
+  }
+  m_merged.push_back(std::move(other->m_scope));
+  for (auto &s : other->m_merged) m_merged.push_back(std::move(s));
+}
+
+
 
 /**
  * primary expression parser
@@ -238,11 +370,12 @@ static presult expand_expression(presult r, scope *sc) {
       s++;
       t = s;
       if (t.type == tok_var) {
+        atom sub = s.sym();
         s++;
         auto v = std::make_shared<ast::dot>(sc);
         v->set_bounds(start_token, t);
         v->expr = expr;
-        v->sub = t.val;
+        v->sub = sub;
         can_assign = true;
         r = presult(v, s);
         continue;
@@ -319,7 +452,7 @@ static presult expand_expression(presult r, scope *sc) {
   s = first;
 
   while (true) {
-    if (s.first().type != tok_comma) {
+    if (s.kind() != tok_comma) {
       break;
     }
     // skip that comma
@@ -344,7 +477,7 @@ static presult expand_expression(presult r, scope *sc) {
 static presult parse_var(pstate s, scope *sc) {
   auto v = std::make_shared<ast::var>(sc);
 
-  std::string name = s.first().val;
+  atom name = s.sym();
   auto found = sc->find(name);
 
   if (found == nullptr) {
@@ -361,7 +494,7 @@ static presult parse_var(pstate s, scope *sc) {
 
 static presult parse_num(pstate s, scope *sc) {
   token t = s;
-  std::string src = t.val;
+  std::string src(s.bytes(t));
   auto node = std::make_shared<ast::number>(sc);
   node->set_bounds(t, t);
 
@@ -392,7 +525,7 @@ static presult parse_num(pstate s, scope *sc) {
 
 static presult parse_str(pstate s, scope *sc) {
   auto n = std::make_shared<ast::string>(sc);
-  n->val = s.first().val;
+  n->val = s.val();
   s++;
   return presult(n, s);
 }
@@ -400,7 +533,7 @@ static presult parse_str(pstate s, scope *sc) {
 
 static presult parse_keyword(pstate s, scope *sc) {
   auto n = std::make_shared<ast::keyword>(sc);
-  n->val = s.first().val;
+  n->val = s.val();
   s++;
   return presult(n, s);
 }
@@ -420,7 +553,7 @@ static presult parse_nil(pstate s, scope *sc) {
  * the paren parser will handle parsing (x) and (x, y) where
  * the first is simply x, and the second is the tuple (x,y)
  */
-static presult parse_paren(pstate s, scope *sc) {
+static presult parse_paren_rule(pstate s, scope *sc) {
   auto init_state = s;
   s++;
   std::vector<rc<ast::node>> exprs;
@@ -471,92 +604,30 @@ static presult parse_paren(pstate s, scope *sc) {
 
 
 static presult parse_function_args(pstate s, scope *sc) {
-  std::vector<rc<ast::node>> args;
-
-  token t = s;
-  if (t.type == tok_left_paren) s++;
-
-  while (true) {
-    t = s;
-    /*t.type == tok_term || t.type == tok_eof || */
-    if (t.type == tok_right_paren) {
-      break;
-    }
-
-    auto res = parse_expr(s, sc, true);
-    if (!res) {
-      return pfail(s);
-    }
-
-    args.push_back(res);
-    s = res;
-    t = s;
-
-    if (t.type == tok_comma) {
-      s++;
-      continue;
-    } else {
-      break;
-    }
-  }
-
-  presult r;
-  r.failed = false;
-  r.vals = args;
-  r.state = s;
-  return r;
+  using namespace pcomb;
+  // an optional open paren, then comma separated expressions up to the close
+  auto expr = rule([sc](pstate s) { return parse_expr(s, sc, true); });
+  auto args = opt(tok(tok_left_paren)) & list(expr, tok_comma, tok_right_paren);
+  return run(args, s);
 }
 
 
 
 /**
  * One of the more complicated parsing functions. Basically turns the flat
- * representation of tokens into a tree based on the `parser_op_prec` map
- * as a precedence table
+ * representation of tokens into a tree with precedence climbing, using the
+ * generated `binary_ops` table (indexed by token type) for precedence and
+ * associativity, so no token text is ever looked at.
  *
- * It also detects assignment and if the lhs is a var, looks up the variable in
- * the scope. If it is not found, it must be a declaration so the function
- * returns a declaration
+ * `lhs` has already been parsed, and operators that bind looser than
+ * `min_prec` are left for the caller
  */
-static presult parse_binary_rhs(pstate s, scope *sc, int expr_prec,
+static presult parse_binary_rhs(pstate s, scope *sc, int min_prec,
                                 rc<ast::node> lhs) {
-  static const auto parser_op_prec = std::map<std::string, int>({
-      {"=", 0},  {"+=", 0},  {"-=", 0},  {"*=", 0},  {"/=", 0}, {"||", 1},
-      {"&&", 1}, {"^", 1},   {"==", 2},  {"!=", 2},  {"<", 10}, {"<=", 10},
-      {">", 10}, {">=", 10}, {">>", 15}, {"<<", 15}, {"+", 20}, {"-", 20},
-      {"*", 40}, {"/", 40},  {"%", 40},
-  });
-
-  /*
-  static const auto assignment_ops = std::map<std::string, int>(
-      {{"=", 0}, {"+=", 0}, {"-=", 0}, {"*=", 0}, {"/=", 0}});
-
-
-  if (assignment_ops.count(s.first().val) != 0) {
-    auto op = s.first().val;
-    s++;
-    auto rhs = parse_expr(s);
-
-    if (!rhs) throw syntax_error(s, "failed to parse rhs of assignment");
-    auto n = std::make_shared<ast::binary_op>();
-    n->op = op;
-    n->left = lhs;
-    n->right = rhs;
-    return presult(n, rhs);
-  }
-  */
-
   while (true) {
     token tok = s;
-    auto bin_op = tok.val;
-    // check if the token is a binary operator or not
-    bool is_binary_op = parser_op_prec.count(tok.val) != 0;
-    if (!is_binary_op || tok.type == tok_eof) {
-      return presult(lhs, s);
-    }
-    auto token_prec = parser_op_prec.at(tok.val);
-
-    if (token_prec < expr_prec) {
+    auto &op = binary_ops[tok.type];
+    if (op.prec < 0 || op.prec < min_prec) {
       return presult(lhs, s);
     }
     // move to the next state
@@ -566,48 +637,32 @@ static presult parse_binary_rhs(pstate s, scope *sc, int expr_prec,
     auto rhs = parse_expr(s, sc, false);
     if (!rhs) {
       throw syntax_error(s, "binary expression missing right hand side");
-      return pfail(s);
     }
-
     s = rhs;
 
-    token t2 = s;
-
-    if (parser_op_prec.count(t2.val) != 0) {
-      auto next_prec = parser_op_prec.at(t2.val);
-      if (token_prec < next_prec) {
-        rhs = parse_binary_rhs(s, sc, token_prec, rhs);
-        if (!rhs) {
-          throw syntax_error(s, "malformed binary expression");
-          return pfail(s);
-        }
-        s = rhs;
+    // any operators after the rhs that bind tighter than this one (or as
+    // tight, if they associate to the right) belong to the rhs
+    while (true) {
+      auto &next = binary_ops[s.kind()];
+      if (next.prec < 0) break;
+      if (next.prec < op.prec || (next.prec == op.prec && !next.right_assoc))
+        break;
+      rhs = parse_binary_rhs(s, sc, next.prec, rhs);
+      if (!rhs) {
+        throw syntax_error(s, "malformed binary expression");
       }
+      s = rhs;
     }
 
     token end = s;
 
     auto n = std::make_shared<ast::binary_op>(sc);
-
     n->set_bounds(tok, end);
-
-    n->op = bin_op;
+    n->op = op.spelling;
     n->left = lhs;
     n->right = rhs;
-
-
-    auto b = std::dynamic_pointer_cast<ast::binary_op>(lhs);
-    if (false && b && bin_op == "=") {
-      auto a = n;
-      a->left = b->right;
-      b->right = a;
-      n = b;
-    }
-
-
     lhs = n;
   }
-  return pfail(s);
 }
 
 
@@ -627,7 +682,7 @@ static presult parse_do(pstate s, scope *sc) {
   while (true) {
     s = glob_term(s);
 
-    if (s.first().type == tok_end) {
+    if (s.kind() == tok_end) {
       break;
     }
     auto res = parse_expr(s, sc);
@@ -650,18 +705,18 @@ static presult parse_do(pstate s, scope *sc) {
  * parse a type out into the special type representation.
  * This function absorbs the generic syntax as well
  */
-static presult parse_type(pstate s, scope *sc) {
+static presult parse_type_rule(pstate s, scope *sc) {
   bool constant = false;
   bool param = false;
 
 
-  if (s.first().type == tok_some) {
+  if (s.kind() == tok_some) {
     param = true;
     s++;
   }
 
 
-  if (s.first().type == tok_const) {
+  if (s.kind() == tok_const) {
     constant = true;
     s++;
   }
@@ -674,12 +729,12 @@ static presult parse_type(pstate s, scope *sc) {
   auto close = tok_right_curly;
 
   // base case, actual type parsing
-  if (s.first().type == tok_type) {
-    if (s.first().val == "Fn") {
+  if (s.kind() == tok_type) {
+    if (s.bytes() == "Fn") {
       // parse method type
       type = std::make_shared<ast::type_node>(sc);
       type->constant = constant;
-      type->name = s.first().val;
+      type->name = s.sym();
       type->style = type_style::METHOD;
       type->parameter = param;
       if (param)
@@ -691,16 +746,16 @@ static presult parse_type(pstate s, scope *sc) {
       s++;
       std::shared_ptr<ast::type_node> return_type = nullptr;
       std::vector<std::shared_ptr<ast::type_node>> types;
-      if (s.first().type != open)
+      if (s.kind() != open)
         throw syntax_error(s, "method type requires parameter information");
       // skip the open token
       s++;
       // normal comma separated list parsing...
       while (true) {
-        if (s.first().type == close) {
+        if (s.kind() == close) {
           break;
         }
-        if (s.first().type == tok_colon) {
+        if (s.kind() == tok_colon) {
           s++;
           auto ret_res = parse_type(s, sc);
           if (!ret_res)
@@ -708,7 +763,7 @@ static presult parse_type(pstate s, scope *sc) {
                                "invalid return type parameter in method type");
           s = ret_res;
           return_type = ret_res.as<ast::type_node>();
-          if (s.first().type != close)
+          if (s.kind() != close)
             throw syntax_error(s, "unexpected token");
           break;
         }
@@ -717,7 +772,7 @@ static presult parse_type(pstate s, scope *sc) {
         s = param_res;
         auto T = param_res.as<ast::type_node>();
         types.push_back(T);
-        if (s.first().type == tok_comma) {
+        if (s.kind() == tok_comma) {
           s++;
           continue;
         }
@@ -729,18 +784,18 @@ static presult parse_type(pstate s, scope *sc) {
     } else {
       type = std::make_shared<ast::type_node>(sc);
       type->constant = constant;
-      type->name = s.first().val;
+      type->name = s.sym();
       type->parameter = param;
 
       s++;
 
 
-      if (s.first().type == open) {
+      if (s.kind() == open) {
         // skip the open token
         s++;
         // normal comma separated list parsing...
         while (true) {
-          if (s.first().type == close) {
+          if (s.kind() == close) {
             break;
           }
 
@@ -751,7 +806,7 @@ static presult parse_type(pstate s, scope *sc) {
 
           auto T = param_res.as<ast::type_node>();
           type->params.push_back(T);
-          if (s.first().type == tok_comma) {
+          if (s.kind() == tok_comma) {
             s++;
             continue;
           }
@@ -763,7 +818,7 @@ static presult parse_type(pstate s, scope *sc) {
     }
   }
 
-  if (s.first().type == tok_left_square) {
+  if (s.kind() == tok_left_square) {
     s++;
 
     auto tr = parse_type(s, sc);
@@ -774,7 +829,7 @@ static presult parse_type(pstate s, scope *sc) {
 
     s = tr;
 
-    if (s.first().type != tok_right_square) {
+    if (s.kind() != tok_right_square) {
       throw syntax_error(s, "unclosed square brackets");
     }
 
@@ -799,7 +854,7 @@ FINALIZE:
 
 
   // absorb optional question marks
-  if (s.first().type == tok_question) {
+  if (s.kind() == tok_question) {
 
     throw syntax_error(s, "optional types not supported currently");
     auto opt = std::make_shared<ast::type_node>(sc);
@@ -832,8 +887,8 @@ std::shared_ptr<ast::type_node> ast::parse_type(text src) {
  * look for it as it won't occur. If we find one, however, it needs to syntax
  * error...
  */
-static presult parse_prototype(pstate s, scope *sc) {
-  bool expect_closing_paren = s.first().type == tok_left_paren;
+static presult parse_prototype_rule(pstate s, scope *sc) {
+  bool expect_closing_paren = s.kind() == tok_left_paren;
 
   // skip over the possible left paren
   if (expect_closing_paren) s++;
@@ -845,12 +900,12 @@ static presult parse_prototype(pstate s, scope *sc) {
   std::vector<std::shared_ptr<ast::type_node>> argument_types;
 
   while (true) {
-    if (s.first().type == tok_term) {
+    if (s.kind() == tok_term) {
       break;
     }
 
-    if ((expect_closing_paren && s.first().type == tok_right_paren) ||
-        s.first().type == tok_colon || s.first().type == tok_term) {
+    if ((expect_closing_paren && s.kind() == tok_right_paren) ||
+        s.kind() == tok_colon || s.kind() == tok_term) {
       break;
     }
 
@@ -868,12 +923,12 @@ static presult parse_prototype(pstate s, scope *sc) {
 
 
 
-    if (s.first().type != tok_var) {
+    if (s.kind() != tok_var) {
       return pfail(s);
     }
 
 
-    text name = s.first().val;
+    atom name = s.sym();
     s++;
 
     argument_types.push_back(atype);
@@ -886,23 +941,23 @@ static presult parse_prototype(pstate s, scope *sc) {
 
     proto->args.push_back(a);
 
-    if (s.first().type != tok_comma && s.first().type != tok_right_paren &&
-        s.first().type != tok_term && s.first().type != tok_colon) {
+    if (s.kind() != tok_comma && s.kind() != tok_right_paren &&
+        s.kind() != tok_term && s.kind() != tok_colon) {
       return pfail(s);
       throw syntax_error(s, "unexpected token");
     }
-    if (s.first().type == tok_comma) s++;
+    if (s.kind() == tok_comma) s++;
   }
 
   if (expect_closing_paren) {
-    if (s.first().type != tok_right_paren) {
+    if (s.kind() != tok_right_paren) {
       return pfail(s);
     }
     s++;
   }
 
 
-  if (s.first().type == tok_colon) {
+  if (s.kind() == tok_colon) {
     s++;
     auto ret = parse_type(s, sc);
     if (ret) {
@@ -931,7 +986,7 @@ static presult parse_prototype(pstate s, scope *sc) {
 
 
 
-static presult parse_function_literal(pstate s, scope *sc) {
+static presult parse_function_literal_rule(pstate s, scope *sc) {
   pstate initial_state = s;
 
 
@@ -953,7 +1008,7 @@ static presult parse_function_literal(pstate s, scope *sc) {
 
   bool valid = false;
 
-  if (s.first().type == tok_arrow) {
+  if (s.kind() == tok_arrow) {
     s++;
     valid = true;
   }
@@ -988,7 +1043,7 @@ static presult parse_return(pstate s, scope *sc) {
 
   auto ret = std::make_shared<ast::return_node>(sc);
 
-  if (s.first().type == tok_term) {
+  if (s.kind() == tok_term) {
     return presult(ret, s);
   }
 
@@ -1012,27 +1067,27 @@ static presult parse_if(pstate s, scope *sc) {
   auto n = std::make_shared<ast::if_node>(sc);
   auto start_token = s.first();
 
-  while (s.first().type != tok_end) {
+  while (s.kind() != tok_end) {
     // new scope for this condition
     auto ns = sc->spawn();
 
     ast::if_node::condition cond;
-    if (s.first().type == tok_if || s.first().type == tok_elif) {
+    if (s.kind() == tok_if || s.kind() == tok_elif) {
       s++;
       auto condr = parse_expr(s, ns);
       if (!condr) throw syntax_error(s, "invalid condition in if block");
       s = condr;
       cond.cond = condr.as<ast::node>();
-    } else if (s.first().type == tok_else) {
+    } else if (s.kind() == tok_else) {
       n->has_default = true;
       s++;
     }
 
     s = glob_term(s);
-    if (s.first().type == tok_then) s++;
+    if (s.kind() == tok_then) s++;
     s = glob_term(s);
 
-    auto ntok = s.first().type;
+    auto ntok = s.kind();
     while (ntok != tok_elif && ntok != tok_else && ntok != tok_end) {
       auto expr_res = parse_expr(s, ns);
 
@@ -1043,7 +1098,7 @@ static presult parse_if(pstate s, scope *sc) {
 
       s = glob_term(s);
 
-      ntok = s.first().type;
+      ntok = s.kind();
     }
     n->conds.push_back(cond);
   }
@@ -1058,6 +1113,85 @@ static presult parse_if(pstate s, scope *sc) {
 
 
 
+/**
+ * parse the statements of a def's body into `fn`, leaving the state at the
+ * `end` token that closes it
+ */
+static pstate parse_def_body(pstate s, scope *sc, ast::func &fn) {
+  while (s.kind() != tok_end) {
+    s = glob_term(s);
+    if (s.kind() == tok_then) s++;
+    s = glob_term(s);
+
+    auto ntok = s.kind();
+    while (ntok != tok_end) {
+      auto expr_res = parse_expr(s, sc);
+
+      if (!expr_res) throw syntax_error(s, "expected expression");
+
+      s = expr_res;
+      fn.stmts.push_back(expr_res);
+
+      s = glob_term(s);
+
+      ntok = s.kind();
+    }
+  }
+  return s;
+}
+
+
+/**
+ * find the `end` that closes a def's body without parsing it, by counting
+ * the constructs in it that are closed with their own `end`
+ */
+static pstate skip_def_body(pstate s) {
+  int depth = 0;
+  while (true) {
+    switch (s.kind()) {
+      case tok_eof:
+        throw syntax_error(s, "expected `end` to close def");
+      case tok_end:
+        if (depth == 0) return s;
+        depth--;
+        break;
+      case tok_def:
+      case tok_do:
+      case tok_if:
+      case tok_typedef:
+        depth++;
+        break;
+    }
+    s++;
+  }
+}
+
+
+struct ast::lazy_body {
+  pstate start;
+  scope *sc;
+  std::once_flag once;
+};
+
+
+void ast::func::parse_body(void) {
+  auto l = std::atomic_load(&m_lazy);
+  if (l == nullptr) return;
+  std::call_once(l->once, [&] {
+    std::unique_lock<std::mutex> lock(l->start.tokens()->parse_lock);
+    try {
+      parse_def_body(l->start, l->sc, *this);
+      ast::resolve_body(*this);
+    } catch (...) {
+      // call_once lets the next caller try again, and get the same error
+      stmts.clear();
+      throw;
+    }
+  });
+  std::atomic_store(&m_lazy, std::shared_ptr<lazy_body>());
+}
+
+
 static presult parse_def(pstate s, scope *sc) {
   auto n = std::make_shared<ast::def>(sc);
 
@@ -1072,8 +1206,8 @@ static presult parse_def(pstate s, scope *sc) {
   sc->fn = n->fn;
 
   s++;
-  if (s.first().type == tok_var) {
-    n->name = s.first().val;
+  if (s.kind() == tok_var) {
+    n->name = s.sym();
   } else {
     throw syntax_error(s, "invalid name for function");
   }
@@ -1090,28 +1224,17 @@ static presult parse_def(pstate s, scope *sc) {
   s = protor;
   s = glob_term(s);
 
-
-  while (s.first().type != tok_end) {
-    rc<ast::node> expr;
-
-    s = glob_term(s);
-    if (s.first().type == tok_then) s++;
-    s = glob_term(s);
-
-    auto ntok = s.first().type;
-    while (ntok != tok_end) {
-      auto expr_res = parse_expr(s, sc);
-
-      if (!expr_res) throw syntax_error(s, "expected expression");
-
-      s = expr_res;
-      n->fn->stmts.push_back(expr_res);
-
-      s = glob_term(s);
-
-      ntok = s.first().type;
-    }
-    // n->expr.push_back(cond);
+  if (s.tokens()->lazy_bodies) {
+    // the body will only see the declarations that exist right now, just as
+    // if it were parsed here
+    sc->hide_from(sc->next_decl_index());
+    auto l = std::make_shared<ast::lazy_body>();
+    l->start = s;
+    l->sc = sc;
+    n->fn->defer_body(l);
+    s = skip_def_body(s);
+  } else {
+    s = parse_def_body(s, sc, *n->fn);
   }
 
   n->fn->set_bounds(start_token, s);
@@ -1129,6 +1252,17 @@ static presult parse_typedef(pstate s, scope *sc) {
 
   s++;
 
+  // only a keyword here, and only when a name follows it, so `type value`
+  // still declares a type named value
+  if (s.kind() == tok_var && s.sym() == atom("value")) {
+    auto next = s;
+    next++;
+    if (next.kind() == tok_var || next.kind() == tok_type) {
+      n->value = true;
+      s = next;
+    }
+  }
+
   auto typer = parse_type(s, sc);
   if (!typer)
     throw syntax_error(s, "Failed to parse type name in type definition");
@@ -1136,7 +1270,11 @@ static presult parse_typedef(pstate s, scope *sc) {
   s = typer;
   n->type = typer.as<ast::type_node>();
 
-  if (s.first().type == tok_extends) {
+  if (s.kind() == tok_extends) {
+    // a value is stored in exactly as many bytes as its type needs, so
+    // there'd be no room for the fields of a subtype
+    if (n->value)
+      throw syntax_error(s, "value types can't extend other types");
     s++;
     auto extendsr = parse_type(s, sc);
     if (!extendsr)
@@ -1147,20 +1285,19 @@ static presult parse_typedef(pstate s, scope *sc) {
   }
   s = glob_term(s);
 
-  while (s.first().type != tok_end) {
-    puts(s.first());
-    if (s.first().type == tok_type || s.first().type == tok_left_square) {
+  while (s.kind() != tok_end) {
+    if (s.kind() == tok_type || s.kind() == tok_left_square) {
       auto typer = parse_type(s, sc);
       if (!typer)
         throw syntax_error(s, "failed to parse field type in type definition");
       s = typer;
 
-      if (s.first().type != tok_var)
+      if (s.kind() != tok_var)
         throw syntax_error(s, "field name must be a variable name");
-      auto name = s.first().val;
+      auto name = s.sym();
       s++;
       n->fields.push_back({.type = typer.as<ast::type_node>(), .name = name});
-    } else if (s.first().type == tok_def) {
+    } else if (s.kind() == tok_def) {
       auto defr = parse_def(s, sc);
       if (!defr)
         throw syntax_error(
@@ -1169,7 +1306,7 @@ static presult parse_typedef(pstate s, scope *sc) {
       s = defr;
     } else {
       std::string e = "unexpected token in type definition: ";
-      e += s.first().val;
+      e += std::string(s.bytes());
       // if you get here, there's an invalid token in the type def
       throw syntax_error(s, e);
     }
@@ -1189,7 +1326,7 @@ static presult parse_let(pstate s, scope *sc) {
 
 
 
-  if (s.first().type == tok_global) {
+  if (s.kind() == tok_global) {
     decl->global = true;
     s++;
   }
@@ -1211,15 +1348,15 @@ static presult parse_let(pstate s, scope *sc) {
     decl->type = get_next_param_type(sc);
   }
 
-  if (s.first().type != tok_var) {
+  if (s.kind() != tok_var) {
     throw syntax_error(s, "unexpected token");
   }
 
-  decl->name = s.first().val;
+  decl->name = s.sym();
   s++;
 
 
-  if (s.first().type == tok_assign) {
+  if (s.kind() == tok_assign) {
     s++;
 
     auto es = parse_expr(s, sc);
@@ -0,0 +1,705 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/printer.h>
+#include <helion/pstate.h>
+#include <math.h>
+#include <stdexcept>
+#include "llvm/Support/Format.h"
+
+using namespace helion;
+using namespace helion::ast;
+
+
+const char *ast::kind_name(node_kind k) {
+  switch (k) {
+    case node_kind::number: return "number";
+    case node_kind::binary_op: return "binary_op";
+    case node_kind::dot: return "dot";
+    case node_kind::subscript: return "subscript";
+    case node_kind::call: return "call";
+    case node_kind::tuple: return "tuple";
+    case node_kind::string: return "string";
+    case node_kind::keyword: return "keyword";
+    case node_kind::nil: return "nil";
+    case node_kind::do_block: return "do_block";
+    case node_kind::return_node: return "return_node";
+    case node_kind::type_node: return "type_node";
+    case node_kind::var_decl: return "var_decl";
+    case node_kind::var: return "var";
+    case node_kind::prototype: return "prototype";
+    case node_kind::func: return "func";
+    case node_kind::def: return "def";
+    case node_kind::if_node: return "if_node";
+    case node_kind::typedef_node: return "typedef_node";
+    case node_kind::typeassert: return "typeassert";
+    case node_kind::if_condition: return "if_condition";
+    case node_kind::field: return "field";
+  }
+  return "unknown";
+}
+
+
+// llvm's StringRef doesn't take a string_view in every version we build with
+static inline llvm::StringRef ref(std::string_view s) {
+  return llvm::StringRef(s.data(), s.size());
+}
+
+
+static const char *style_name(type_style s) {
+  switch (s) {
+    case type_style::OBJECT: return "object";
+    case type_style::SLICE: return "slice";
+    case type_style::METHOD: return "method";
+    case type_style::OPTIONAL: return "optional";
+    default: return "other";
+  }
+}
+
+
+
+namespace {
+
+  // helion syntax. Each node prints itself as its str() always has
+  class source_printer {
+    llvm::raw_ostream &out;
+
+    void indent(int depth) { out.indent(depth * 2); }
+
+    // a list separated by commas, where a missing node still gets its comma
+    template <typename T>
+    void join(const std::vector<T> &nodes) {
+      for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i] != nullptr) print(nodes[i].get());
+        if (i < nodes.size() - 1) out << ", ";
+      }
+    }
+
+    // statements on their own lines, one level in from `depth`
+    template <typename T>
+    void lines(const std::vector<T> &nodes, int depth) {
+      for (auto &e : nodes) {
+        indent(depth);
+        out << "  ";
+        print(e.get(), depth + 1);
+        out << "\n";
+      }
+    }
+
+   public:
+    source_printer(llvm::raw_ostream &out) : out(out) {}
+
+    void print(node *n, int depth = 0) {
+      switch (n->kind) {
+        case node_kind::number: {
+          auto *num = static_cast<number *>(n);
+          if (num->type == number::floating)
+            out << llvm::format("%f", num->as.floating);
+          else
+            out << num->as.integer;
+          break;
+        }
+
+        case node_kind::binary_op: {
+          auto *op = static_cast<binary_op *>(n);
+          out << "(";
+          print(op->left.get());
+          out << " " << ref(op->op.view()) << " ";
+          print(op->right.get());
+          out << ")";
+          break;
+        }
+
+        case node_kind::dot: {
+          auto *d = static_cast<dot *>(n);
+          print(d->expr.get());
+          out << "." << ref(d->sub.view());
+          break;
+        }
+
+        case node_kind::subscript: {
+          auto *sub = static_cast<subscript *>(n);
+          out << "(";
+          print(sub->expr.get());
+          out << "[";
+          join(sub->subs);
+          out << "])";
+          break;
+        }
+
+        case node_kind::call: {
+          auto *c = static_cast<call *>(n);
+          print(c->func.get());
+          out << "(";
+          join(c->args);
+          out << ")";
+          break;
+        }
+
+        case node_kind::tuple: {
+          auto &vals = static_cast<tuple *>(n)->vals;
+          out << "(";
+          if (vals.size() == 1) {
+            // (a,) so it isn't read back as a parenthesized expression
+            if (vals[0] != nullptr) print(vals[0].get());
+            out << ",";
+          } else {
+            join(vals);
+          }
+          out << ")";
+          break;
+        }
+
+        case node_kind::string:
+          out << "'" << ref(static_cast<string *>(n)->val.view()) << "'";
+          break;
+
+        case node_kind::keyword:
+          out << ref(static_cast<keyword *>(n)->val.view());
+          break;
+
+        case node_kind::nil:
+          out << "nil";
+          break;
+
+        case node_kind::do_block:
+          out << "do\n";
+          lines(static_cast<do_block *>(n)->exprs, depth);
+          indent(depth);
+          out << "end";
+          break;
+
+        case node_kind::return_node: {
+          auto *r = static_cast<return_node *>(n);
+          out << "return";
+          if (r->val != nullptr) {
+            out << " ";
+            print(r->val.get(), depth + 1);
+          }
+          break;
+        }
+
+        case node_kind::type_node:
+          type(static_cast<type_node *>(n));
+          break;
+
+        case node_kind::var_decl: {
+          auto *d = static_cast<var_decl *>(n);
+          if (!d->is_arg) out << "let ";
+          if (d->global) out << "global ";
+          if (d->type != nullptr) {
+            type(d->type.get());
+            out << " ";
+          }
+          out << ref(d->name.view());
+          if (d->value != nullptr) {
+            out << " = ";
+            print(d->value.get(), depth + 1);
+          }
+          break;
+        }
+
+        case node_kind::var: {
+          auto *v = static_cast<var *>(n);
+          out << ref((v->global ? v->global_name : v->decl->name).view());
+          break;
+        }
+
+        case node_kind::prototype: {
+          auto *p = static_cast<prototype *>(n);
+          out << "(";
+          join(p->args);
+          out << ")";
+          if (p->type->params[0] != nullptr) {
+            out << " : ";
+            type(p->type->params[0].get());
+          }
+          break;
+        }
+
+        case node_kind::func: {
+          auto *f = static_cast<func *>(n);
+          print(f->proto.get());
+          out << " -> ";
+          if (!f->body_parsed()) {
+            out << "...";
+          } else if (f->stmts.size() > 1) {
+            out << "do\n";
+            lines(f->stmts, depth);
+            indent(depth);
+            out << "end";
+          } else if (!f->stmts.empty()) {
+            print(f->stmts[0].get(), depth + 1);
+          }
+          break;
+        }
+
+        case node_kind::def: {
+          auto *d = static_cast<def *>(n);
+          out << "def " << ref(d->name.view()) << " ";
+          if (d->fn->proto != nullptr) print(d->fn->proto.get());
+          out << "\n";
+          if (!d->fn->body_parsed()) {
+            indent(depth);
+            out << "  ...\n";
+          }
+          lines(d->fn->stmts, depth);
+          indent(depth);
+          out << "end";
+          break;
+        }
+
+        case node_kind::if_node: {
+          bool printed_if = false;
+          for (auto &c : static_cast<if_node *>(n)->conds) {
+            if (printed_if) indent(depth);
+            if (c.cond) {
+              out << (!printed_if ? "if " : "elif ");
+              printed_if = true;
+              print(c.cond.get());
+              out << " then\n";
+            } else {
+              out << "else\n";
+            }
+            lines(c.body, depth);
+          }
+          indent(depth);
+          out << "end";
+          break;
+        }
+
+        case node_kind::typedef_node: {
+          auto *t = static_cast<typedef_node *>(n);
+          out << (t->value ? "type value " : "type ");
+          type(t->type.get());
+          if (t->extends != nullptr) {
+            out << " extends ";
+            type(t->extends.get());
+          }
+          out << "\n";
+          for (auto &field : t->fields) {
+            indent(depth);
+            out << "  ";
+            type(field.type.get());
+            out << " " << ref(field.name.view()) << "\n";
+          }
+          lines(t->defs, depth);
+          indent(depth);
+          out << "end";
+          break;
+        }
+
+        case node_kind::typeassert: {
+          auto *a = static_cast<typeassert *>(n);
+          out << "(";
+          print(a->val.get());
+          out << " :: ";
+          type(a->type.get());
+          out << ")";
+          break;
+        }
+
+        default:
+          throw std::logic_error("unknown ast node kind in print");
+      }
+    }
+
+    void type(type_node *t) {
+      if (t->parameter) out << "some ";
+      if (t->constant) out << "const ";
+
+      auto &params = t->params;
+      switch (t->style) {
+        case type_style::OBJECT:
+          out << ref(t->name.view());
+          if (!params.empty()) {
+            out << "{";
+            join(params);
+            out << "}";
+          }
+          break;
+
+        case type_style::SLICE:
+          out << "[";
+          type(params[0].get());
+          out << "]";
+          break;
+
+        case type_style::METHOD:
+          out << "Fn{";
+          for (size_t i = 1; i < params.size(); i++) {
+            type(params[i].get());
+            if (i < params.size() - 1) out << ", ";
+          }
+          if (params[0] != nullptr) {
+            out << " : ";
+            type(params[0].get());
+          }
+          out << "}";
+          break;
+
+        case type_style::OPTIONAL:
+          type(params[0].get());
+          out << "?";
+          break;
+
+        default:
+          break;
+      }
+    }
+  };
+
+
+
+  /**
+   * the sexpr and json formats. They have the same shape: a node is its kind
+   * followed by named fields, so one walk writes both
+   */
+  class tree_printer {
+    llvm::raw_ostream &out;
+    bool json;
+
+    void begin(const char *kind) {
+      if (json)
+        out << "{\"kind\": \"" << kind << "\"";
+      else
+        out << "(" << kind;
+    }
+
+    void end(void) { out << (json ? "}" : ")"); }
+
+    void key(const char *name) {
+      if (json)
+        out << ", \"" << name << "\": ";
+      else
+        out << " :" << name << " ";
+    }
+
+    void quoted(llvm::StringRef s) {
+      out << '"';
+      for (char c : s) {
+        switch (c) {
+          case '"': out << "\\\""; break;
+          case '\\': out << "\\\\"; break;
+          case '\n': out << "\\n"; break;
+          case '\t': out << "\\t"; break;
+          case '\r': out << "\\r"; break;
+          default:
+            if ((unsigned char)c < 0x20)
+              out << llvm::format("\\u%04x", c);
+            else
+              out << c;
+        }
+      }
+      out << '"';
+    }
+
+    void field(const char *name, llvm::StringRef s) {
+      key(name);
+      quoted(s);
+    }
+    void field(const char *name, atom a) { field(name, ref(a.view())); }
+    void field(const char *name, const text &t) { field(name, ref(t.view())); }
+    void field(const char *name, int64_t i) {
+      key(name);
+      out << i;
+    }
+    void flag(const char *name, bool b) {
+      key(name);
+      if (json)
+        out << (b ? "true" : "false");
+      else
+        out << (b ? "t" : "nil");
+    }
+    void field(const char *name, node *n) {
+      key(name);
+      print(n);
+    }
+
+    template <typename T>
+    void list(const char *name, const std::vector<T> &nodes) {
+      key(name);
+      list(nodes);
+    }
+
+    template <typename T>
+    void list(const std::vector<T> &nodes) {
+      out << (json ? "[" : "(");
+      for (size_t i = 0; i < nodes.size(); i++) {
+        if (i != 0) out << (json ? ", " : " ");
+        print(nodes[i].get());
+      }
+      out << (json ? "]" : ")");
+    }
+
+    // a variable's place in its frame, if it was resolved to one
+    void address(int depth, int slot) {
+      if (slot < 0) return;
+      field("depth", (int64_t)depth);
+      field("slot", (int64_t)slot);
+    }
+
+   public:
+    tree_printer(llvm::raw_ostream &out, bool json) : out(out), json(json) {}
+
+    void print(node *n) {
+      if (n == nullptr) {
+        out << (json ? "null" : "nil");
+        return;
+      }
+
+      begin(kind_name(n->kind));
+      switch (n->kind) {
+        case node_kind::number: {
+          auto *num = static_cast<number *>(n);
+          key("value");
+          if (num->type == number::integer)
+            out << num->as.integer;
+          else if (isfinite(num->as.floating))
+            out << llvm::format("%.17g", num->as.floating);
+          else
+            out << (json ? "null" : "nan");
+          break;
+        }
+
+        case node_kind::binary_op: {
+          auto *op = static_cast<binary_op *>(n);
+          field("op", op->op);
+          field("left", op->left.get());
+          field("right", op->right.get());
+          break;
+        }
+
+        case node_kind::dot: {
+          auto *d = static_cast<dot *>(n);
+          field("expr", d->expr.get());
+          field("sub", d->sub);
+          break;
+        }
+
+        case node_kind::subscript: {
+          auto *sub = static_cast<subscript *>(n);
+          field("expr", sub->expr.get());
+          list("subs", sub->subs);
+          break;
+        }
+
+        case node_kind::call: {
+          auto *c = static_cast<call *>(n);
+          field("func", c->func.get());
+          list("args", c->args);
+          break;
+        }
+
+        case node_kind::tuple:
+          list("vals", static_cast<tuple *>(n)->vals);
+          break;
+
+        case node_kind::string:
+          field("val", static_cast<string *>(n)->val);
+          break;
+
+        case node_kind::keyword:
+          field("val", static_cast<keyword *>(n)->val);
+          break;
+
+        case node_kind::nil:
+          break;
+
+        case node_kind::do_block:
+          list("exprs", static_cast<do_block *>(n)->exprs);
+          break;
+
+        case node_kind::return_node:
+          field("val", static_cast<return_node *>(n)->val.get());
+          break;
+
+        case node_kind::type_node: {
+          auto *t = static_cast<type_node *>(n);
+          field("name", t->name);
+          field("style", llvm::StringRef(style_name(t->style)));
+          if (t->constant) flag("constant", true);
+          if (t->parameter) flag("parameter", true);
+          list("params", t->params);
+          break;
+        }
+
+        case node_kind::var_decl: {
+          auto *d = static_cast<var_decl *>(n);
+          field("name", d->name);
+          if (d->global) flag("global", true);
+          if (d->is_arg) flag("arg", true);
+          address(d->depth, d->slot);
+          field("type", d->type.get());
+          field("value", d->value.get());
+          break;
+        }
+
+        case node_kind::var: {
+          auto *v = static_cast<var *>(n);
+          field("name", v->global ? v->global_name : v->decl->name);
+          if (v->global) flag("global", true);
+          address(v->depth, v->slot);
+          break;
+        }
+
+        case node_kind::prototype: {
+          auto *p = static_cast<prototype *>(n);
+          list("args", p->args);
+          field("returns", p->type != nullptr ? p->type->params[0].get()
+                                              : nullptr);
+          break;
+        }
+
+        case node_kind::func: {
+          auto *f = static_cast<func *>(n);
+          if (f->anonymous) flag("anonymous", true);
+          field("proto", f->proto.get());
+          if (f->body_parsed())
+            list("stmts", f->stmts);
+          else
+            flag("elided", true);
+          break;
+        }
+
+        case node_kind::def: {
+          auto *d = static_cast<def *>(n);
+          field("name", d->name);
+          field("fn", d->fn.get());
+          break;
+        }
+
+        case node_kind::if_node: {
+          auto &conds = static_cast<if_node *>(n)->conds;
+          key("conds");
+          out << (json ? "[" : "(");
+          for (size_t i = 0; i < conds.size(); i++) {
+            if (i != 0) out << (json ? ", " : " ");
+            begin(kind_name(node_kind::if_condition));
+            field("cond", conds[i].cond.get());
+            list("body", conds[i].body);
+            end();
+          }
+          out << (json ? "]" : ")");
+          break;
+        }
+
+        case node_kind::typedef_node: {
+          auto *t = static_cast<typedef_node *>(n);
+          if (t->value) flag("value", true);
+          field("type", t->type.get());
+          field("extends", t->extends.get());
+          key("fields");
+          out << (json ? "[" : "(");
+          for (size_t i = 0; i < t->fields.size(); i++) {
+            if (i != 0) out << (json ? ", " : " ");
+            begin(kind_name(node_kind::field));
+            field("name", t->fields[i].name);
+            field("type", t->fields[i].type.get());
+            end();
+          }
+          out << (json ? "]" : ")");
+          list("defs", t->defs);
+          break;
+        }
+
+        case node_kind::typeassert: {
+          auto *a = static_cast<typeassert *>(n);
+          field("val", a->val.get());
+          field("type", a->type.get());
+          break;
+        }
+
+        default:
+          throw std::logic_error("unknown ast node kind in print");
+      }
+      end();
+    }
+
+    void print(ast::module &m) {
+      begin("module");
+      list("typedefs", m.typedefs);
+      list("defs", m.defs);
+      field("entry", m.entry.get());
+      end();
+    }
+  };
+
+}  // namespace
+
+
+
+void ast::print(llvm::raw_ostream &out, node *n, print_format format,
+                int depth) {
+  if (format == print_format::source)
+    source_printer(out).print(n, depth);
+  else
+    tree_printer(out, format == print_format::json).print(n);
+}
+
+
+void ast::print(llvm::raw_ostream &out, module &m, print_format format) {
+  if (format != print_format::source) {
+    tree_printer(out, format == print_format::json).print(m);
+    return;
+  }
+  source_printer p(out);
+  for (auto &d : m.defs) {
+    p.print(d.get());
+    out << "\n\n";
+  }
+  for (auto &t : m.typedefs) {
+    p.print(t.get());
+    out << "\n\n";
+  }
+  if (m.entry != nullptr) {
+    p.print(m.entry.get());
+    out << "\n\n";
+  }
+}
+
+
+
+text ast::node::str(int depth) {
+  std::string s;
+  llvm::raw_string_ostream out(s);
+  print(out, this, print_format::source, depth);
+  return text(out.str());
+}
+
+
+text ast::module::str(int) {
+  std::string s;
+  llvm::raw_string_ostream out(s);
+  print(out, *this);
+  return text(out.str());
+}
+
+
+text scope::str(int) {
+  std::string s;
+  llvm::raw_string_ostream out(s);
+  print(out);
+  return text(out.str());
+}
+
+
+void scope::print(llvm::raw_ostream &out) {
+  out << "{\"vars\": [";
+  size_t i = 0;
+  for (auto &v : m_vars) {
+    if (i++ != 0) out << ", ";
+    out << "\"" << ref(v.first.view()) << "\"";
+  }
+  out << "]";
+
+  if (!children.empty()) {
+    out << ", \"children\": [";
+    for (size_t c = 0; c < children.size(); c++) {
+      if (c != 0) out << ", ";
+      children[c]->print(out);
+    }
+    out << "]";
+  }
+  out << "}";
+}
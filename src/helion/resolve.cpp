@@ -0,0 +1,200 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/resolve.h>
+#include <stdexcept>
+
+using namespace helion;
+using namespace helion::ast;
+
+
+namespace {
+
+  // walks a tree in source order, giving declarations slots in the frame of
+  // the function `fn` they're in. A var always comes after the declaration
+  // it points to, so that already has its slot by the time the var is seen
+  class resolver {
+    func *fn;
+
+    void declare(var_decl *d) {
+      if (d->global) {
+        d->depth = d->slot = -1;
+        return;
+      }
+      d->depth = fn->depth;
+      d->slot = fn->frame_size++;
+    }
+
+    template <typename T>
+    void walk(const std::vector<T> &nodes) {
+      for (auto &n : nodes) walk(n.get());
+    }
+
+   public:
+    resolver(func *fn) : fn(fn) {}
+
+    // resolve a function nested in the current one, and what's in it
+    void enter(func *f, int depth) {
+      f->depth = depth;
+      f->frame_size = 0;
+      func *outer = fn;
+      fn = f;
+      if (f->proto != nullptr) walk(f->proto->args);
+      // a skipped body is resolved once it's parsed
+      if (f->body_parsed()) walk(f->stmts);
+      fn = outer;
+    }
+
+    void walk(node *n) {
+      if (n == nullptr) return;
+      switch (n->kind) {
+        case node_kind::binary_op: {
+          auto *op = static_cast<binary_op *>(n);
+          walk(op->left.get());
+          walk(op->right.get());
+          break;
+        }
+
+        case node_kind::dot:
+          walk(static_cast<dot *>(n)->expr.get());
+          break;
+
+        case node_kind::subscript: {
+          auto *sub = static_cast<subscript *>(n);
+          walk(sub->expr.get());
+          walk(sub->subs);
+          break;
+        }
+
+        case node_kind::call: {
+          auto *c = static_cast<call *>(n);
+          walk(c->func.get());
+          walk(c->args);
+          break;
+        }
+
+        case node_kind::tuple:
+          walk(static_cast<tuple *>(n)->vals);
+          break;
+
+        case node_kind::do_block:
+          walk(static_cast<do_block *>(n)->exprs);
+          break;
+
+        case node_kind::return_node:
+          walk(static_cast<return_node *>(n)->val.get());
+          break;
+
+        case node_kind::var_decl: {
+          // the value is parsed before the name is bound, so it can't see it
+          auto *d = static_cast<var_decl *>(n);
+          walk(d->value.get());
+          declare(d);
+          break;
+        }
+
+        case node_kind::var: {
+          auto *v = static_cast<var *>(n);
+          v->depth = v->slot = -1;
+          auto *d = v->decl.get();
+          if (v->global || d == nullptr || d->slot < 0) break;
+          v->depth = fn->depth - d->depth;
+          v->slot = d->slot;
+          break;
+        }
+
+        case node_kind::prototype:
+          walk(static_cast<prototype *>(n)->args);
+          break;
+
+        case node_kind::func:
+          enter(static_cast<func *>(n), fn->depth + 1);
+          break;
+
+        case node_kind::def:
+          walk(static_cast<def *>(n)->fn.get());
+          break;
+
+        case node_kind::if_node:
+          for (auto &c : static_cast<if_node *>(n)->conds) {
+            walk(c.cond.get());
+            walk(c.body);
+          }
+          break;
+
+        case node_kind::typedef_node:
+          walk(static_cast<typedef_node *>(n)->defs);
+          break;
+
+        case node_kind::typeassert:
+          walk(static_cast<typeassert *>(n)->val.get());
+          break;
+
+        // nothing in these can refer to a variable
+        case node_kind::number:
+        case node_kind::string:
+        case node_kind::keyword:
+        case node_kind::nil:
+        case node_kind::type_node:
+          break;
+
+        default:
+          throw std::logic_error("unknown ast node kind in resolve");
+      }
+    }
+  };
+
+}  // namespace
+
+
+
+void ast::resolve(module &m) {
+  if (m.entry == nullptr) return;
+  resolver r(nullptr);
+  r.enter(m.entry->fn.get(), 0);
+
+  // everything else is nested in the entry, as far as frames go
+  resolver in_entry(m.entry->fn.get());
+  for (auto &t : m.typedefs) in_entry.walk(t.get());
+  for (auto &d : m.defs) in_entry.walk(d.get());
+}
+
+
+void ast::resolve(module &m, const std::vector<std::shared_ptr<node>> &nodes) {
+  if (m.entry == nullptr) return;
+  func *entry = m.entry->fn.get();
+  if (entry->depth < 0) {
+    resolve(m);
+    return;
+  }
+  resolver r(entry);
+  for (auto &n : nodes) r.walk(n.get());
+}
+
+
+void ast::resolve_edit(module &m,
+                       const std::vector<std::shared_ptr<node>> &changed) {
+  if (m.entry == nullptr) return;
+  func *entry = m.entry->fn.get();
+  if (entry->depth < 0) {
+    resolve(m);
+    return;
+  }
+
+  entry->frame_size = 0;
+  resolver r(entry);
+  if (entry->proto != nullptr) r.walk(entry->proto.get());
+  for (auto &s : entry->stmts) r.walk(s.get());
+  for (auto &n : changed) {
+    if (isa<def>(n) || isa<typedef_node>(n)) r.walk(n.get());
+  }
+}
+
+
+
+void ast::resolve_body(func &f) {
+  // it will be resolved along with whatever it's in
+  if (f.depth < 0) return;
+  resolver r(&f);
+  for (auto &s : f.stmts) r.walk(s.get());
+}
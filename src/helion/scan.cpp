@@ -0,0 +1,260 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/scan.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HELION_SCAN_X86
+#endif
+
+using namespace helion;
+
+
+/**
+ * scalar implementations. These are the fallback on non-x86 machines, and
+ * finish off the tails of the vector implementations
+ */
+static inline bool is_word_byte(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char *skip_spaces_scalar(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  return p;
+}
+
+static const char *find_newline_scalar(const char *p, const char *end) {
+  while (p < end && *p != '\n') p++;
+  return p;
+}
+
+static const char *skip_word_scalar(const char *p, const char *end) {
+  while (p < end && is_word_byte(*p)) p++;
+  return p;
+}
+
+static size_t count_newlines_scalar(const char *p, const char *end) {
+  size_t n = 0;
+  for (; p < end; p++) n += *p == '\n';
+  return n;
+}
+
+static size_t count_runes_scalar(const char *p, const char *end) {
+  size_t n = 0;
+  // every byte but a continuation byte (10xxxxxx) starts a code point
+  for (; p < end; p++) n += (*p & 0xC0) != 0x80;
+  return n;
+}
+
+
+
+#ifdef HELION_SCAN_X86
+
+/**
+ * SSE2 implementations, which every x86_64 machine has. Each loop classifies
+ * 16 bytes at a time into a bitmask and uses the lowest set bit to find where
+ * the scan stops.
+ */
+
+// a mask of the bytes in the range [lo, lo + len). Biasing by 128 lets the
+// signed byte compare act as an unsigned one
+static inline __m128i in_range_sse2(__m128i v, int lo, int len) {
+  __m128i biased = _mm_sub_epi8(v, _mm_set1_epi8((char)(lo + 128)));
+  return _mm_cmplt_epi8(biased, _mm_set1_epi8((char)(len - 128)));
+}
+
+static const char *skip_spaces_sse2(const char *p, const char *end) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+    unsigned stop = ~_mm_movemask_epi8(hit) & 0xFFFF;
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return skip_spaces_scalar(p, end);
+}
+
+static const char *find_newline_sse2(const char *p, const char *end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    unsigned stop = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return find_newline_scalar(p, end);
+}
+
+static const char *skip_word_sse2(const char *p, const char *end) {
+  const __m128i under = _mm_set1_epi8('_');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(in_range_sse2(v, 'a', 26), in_range_sse2(v, 'A', 26)),
+        _mm_or_si128(in_range_sse2(v, '0', 10), _mm_cmpeq_epi8(v, under)));
+    unsigned stop = ~_mm_movemask_epi8(hit) & 0xFFFF;
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return skip_word_scalar(p, end);
+}
+
+static size_t count_newlines_sse2(const char *p, const char *end) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t n = 0;
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+  }
+  return n + count_newlines_scalar(p, end);
+}
+
+static size_t count_runes_sse2(const char *p, const char *end) {
+  // as signed bytes, continuation bytes are exactly those <= (int8_t)0xBF
+  const __m128i cont = _mm_set1_epi8((char)0xBF);
+  size_t n = 0;
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont)));
+  }
+  return n + count_runes_scalar(p, end);
+}
+
+
+
+/**
+ * AVX2 implementations, the same as above but 32 bytes at a time. They are
+ * compiled for AVX2 regardless of the build flags, and only called if the
+ * CPU reports support for it.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i in_range_avx2(__m256i v, int lo, int len) {
+  __m256i biased = _mm256_sub_epi8(v, _mm256_set1_epi8((char)(lo + 128)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(len - 128)), biased);
+}
+
+AVX2 static const char *skip_spaces_avx2(const char *p, const char *end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hit =
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(hit);
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return skip_spaces_sse2(p, end);
+}
+
+AVX2 static const char *find_newline_avx2(const char *p, const char *end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t stop = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return find_newline_sse2(p, end);
+}
+
+AVX2 static const char *skip_word_avx2(const char *p, const char *end) {
+  const __m256i under = _mm256_set1_epi8('_');
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(in_range_avx2(v, 'a', 26), in_range_avx2(v, 'A', 26)),
+        _mm256_or_si256(in_range_avx2(v, '0', 10),
+                        _mm256_cmpeq_epi8(v, under)));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(hit);
+    if (stop != 0) return p + __builtin_ctz(stop);
+  }
+  return skip_word_sse2(p, end);
+}
+
+AVX2 static size_t count_newlines_avx2(const char *p, const char *end) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t n = 0;
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+  }
+  return n + count_newlines_sse2(p, end);
+}
+
+AVX2 static size_t count_runes_avx2(const char *p, const char *end) {
+  const __m256i cont = _mm256_set1_epi8((char)0xBF);
+  size_t n = 0;
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont)));
+  }
+  return n + count_runes_sse2(p, end);
+}
+
+#undef AVX2
+
+#endif
+
+
+
+namespace {
+  struct scan_impl {
+    const char *name;
+    const char *(*skip_spaces)(const char *, const char *);
+    const char *(*find_newline)(const char *, const char *);
+    const char *(*skip_word)(const char *, const char *);
+    size_t (*count_newlines)(const char *, const char *);
+    size_t (*count_runes)(const char *, const char *);
+  };
+}  // namespace
+
+
+static scan_impl pick_impl(void) {
+#ifdef HELION_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2",         skip_spaces_avx2,   find_newline_avx2,
+            skip_word_avx2, count_newlines_avx2, count_runes_avx2};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {"sse2",         skip_spaces_sse2,   find_newline_sse2,
+            skip_word_sse2, count_newlines_sse2, count_runes_sse2};
+  }
+#endif
+  return {"scalar",         skip_spaces_scalar,   find_newline_scalar,
+          skip_word_scalar, count_newlines_scalar, count_runes_scalar};
+}
+
+
+static const scan_impl &impl(void) {
+  // initialized exactly once, even if first used from several threads
+  static const scan_impl active = pick_impl();
+  return active;
+}
+
+
+
+const char *scan::skip_spaces(const char *p, const char *end) {
+  return impl().skip_spaces(p, end);
+}
+
+const char *scan::find_newline(const char *p, const char *end) {
+  return impl().find_newline(p, end);
+}
+
+const char *scan::skip_word(const char *p, const char *end) {
+  return impl().skip_word(p, end);
+}
+
+size_t scan::count_newlines(const char *p, const char *end) {
+  return impl().count_newlines(p, end);
+}
+
+size_t scan::count_runes(const char *p, const char *end) {
+  return impl().count_runes(p, end);
+}
+
+const char *scan::impl_name(void) { return impl().name; }
@@ -0,0 +1,264 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <fcntl.h>
+#include <helion/scan.h>
+#include <helion/source.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace helion;
+
+
+
+source_buffer::~source_buffer() {
+  if (m_map != nullptr) munmap(m_map, m_size);
+}
+
+
+
+std::shared_ptr<source_buffer> source_buffer::map_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat sinfo;
+  if (fstat(fd, &sinfo) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto buf = std::make_shared<source_buffer>();
+
+  // mmap refuses zero length mappings, so empty files are simply an empty
+  // buffer with no backing storage
+  if (sinfo.st_size == 0) {
+    close(fd);
+    buf->m_data = buf->m_owned.data();
+    return buf;
+  }
+
+  void *map = mmap(nullptr, sinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping holds its own reference to the file
+  close(fd);
+  if (map == MAP_FAILED) return nullptr;
+
+  // the tokenizer walks the file front to back exactly once
+  madvise(map, sinfo.st_size, MADV_SEQUENTIAL);
+
+  buf->m_map = map;
+  buf->m_data = (const char *)map;
+  buf->m_size = sinfo.st_size;
+  return buf;
+}
+
+
+
+std::shared_ptr<source_buffer> source_buffer::from_string(std::string s) {
+  auto buf = std::make_shared<source_buffer>();
+  buf->m_owned = std::move(s);
+  buf->m_data = buf->m_owned.data();
+  buf->m_size = buf->m_owned.size();
+  return buf;
+}
+
+
+
+const std::vector<uint32_t> &source_file::lines(void) {
+  std::call_once(m_lines_built, [this] {
+    const char *src = m_buffer->data();
+    const char *end = src + m_buffer->size();
+    // counting first is a cheap vector pass, and saves growing the table
+    // over and over on big files
+    m_lines.reserve(scan::count_newlines(src, end) + 1);
+    m_lines.push_back(0);
+    for (const char *p = scan::find_newline(src, end); p < end;
+         p = scan::find_newline(p + 1, end)) {
+      m_lines.push_back(p + 1 - src);
+    }
+  });
+  return m_lines;
+}
+
+
+size_t source_file::line_count(void) { return lines().size(); }
+
+
+position source_file::position_of(size_t offset) {
+  auto &ls = lines();
+  // the last line starting at or before the offset
+  size_t line = std::upper_bound(ls.begin(), ls.end(), offset) - ls.begin() - 1;
+  const char *src = m_buffer->data();
+  position pos;
+  pos.line = line;
+  pos.col = scan::count_runes(src + ls[line], src + offset);
+  return pos;
+}
+
+
+std::string_view source_file::line_text(size_t line) {
+  auto &ls = lines();
+  if (line >= ls.size()) return std::string_view();
+  size_t start = ls[line];
+  size_t end = line + 1 < ls.size() ? ls[line + 1] - 1 : m_buffer->size();
+  return std::string_view(m_buffer->data() + start, end - start);
+}
+
+
+
+source_manager &source_manager::global(void) {
+  static source_manager mgr;
+  return mgr;
+}
+
+
+source_file *source_manager::add(std::shared_ptr<source_buffer> buf,
+                                 std::string path) {
+  auto file = std::make_unique<source_file>();
+  file->m_path = std::move(path);
+  file->m_buffer = std::move(buf);
+
+  std::unique_lock<std::mutex> l(lock);
+  // one past the end of the file is a location as well, for the eof token
+  file->m_base = take(file->m_buffer->size() + 1);
+  files.push_back(std::move(file));
+  return files.back().get();
+}
+
+
+// the lock must be held
+uint64_t source_manager::take(uint64_t span) {
+  if (next_loc + span > UINT32_MAX)
+    throw std::logic_error("too much source loaded for 32 bit locations");
+  uint64_t base = next_loc;
+  next_loc += span;
+  return base;
+}
+
+
+
+source_loc source_manager::reserve(size_t span) {
+  std::unique_lock<std::mutex> l(lock);
+  range r{0, span};
+  // the smallest released range it fits in, splitting off what's left
+  auto best = free_ranges.end();
+  for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+    if (it->span < span) continue;
+    if (best == free_ranges.end() || it->span < best->span) best = it;
+  }
+  if (best != free_ranges.end()) {
+    r.base = best->base;
+    best->base += span;
+    best->span -= span;
+    if (best->span == 0) free_ranges.erase(best);
+  } else {
+    r.base = take(span);
+  }
+  reserved.push_back(r);
+  return r.base;
+}
+
+
+void source_manager::release(source_loc base) {
+  std::unique_lock<std::mutex> l(lock);
+  for (auto it = reserved.begin(); it != reserved.end(); ++it) {
+    if (it->base != base) continue;
+    range r = *it;
+    reserved.erase(it);
+    // joined up with released ranges next to it, so a lot of short lived
+    // sources don't leave the space in pieces too small to reuse
+    for (size_t i = 0; i < free_ranges.size();) {
+      auto &f = free_ranges[i];
+      if (f.base + f.span == r.base || r.base + r.span == f.base) {
+        r.base = std::min(r.base, f.base);
+        r.span += f.span;
+        free_ranges[i] = free_ranges.back();
+        free_ranges.pop_back();
+      } else {
+        i++;
+      }
+    }
+    if (r.base + r.span == next_loc)
+      next_loc = r.base;
+    else
+      free_ranges.push_back(r);
+    return;
+  }
+  throw std::logic_error("releasing a range that isn't reserved");
+}
+
+
+std::unique_ptr<source_file> source_manager::make(
+    std::shared_ptr<source_buffer> buf, std::string path, source_loc base) {
+  auto file = std::make_unique<source_file>();
+  file->m_path = std::move(path);
+  file->m_buffer = std::move(buf);
+  file->m_base = base;
+  return file;
+}
+
+
+source_file *source_manager::adopt(std::unique_ptr<source_file> file) {
+  std::unique_lock<std::mutex> l(lock);
+  uint64_t base = file->m_base, end = base + file->m_buffer->size() + 1;
+  bool inside = false;
+  for (auto &r : reserved) {
+    if (base >= r.base && end <= r.base + r.span) inside = true;
+  }
+  if (!inside)
+    throw std::logic_error("adopted files have to be in a reserved range");
+
+  auto it = std::upper_bound(
+      files.begin(), files.end(), file->m_base,
+      [](source_loc l, const std::unique_ptr<source_file> &f) {
+        return l < f->base();
+      });
+  // it would be wrong to find a location in two files
+  if (it != files.begin() && (it - 1)->get()->contains(file->m_base))
+    throw std::logic_error("adopted file overlaps a loaded one");
+  if (it != files.end() && (*it)->m_base < end)
+    throw std::logic_error("adopted file overlaps a loaded one");
+  return files.insert(it, std::move(file))->get();
+}
+
+
+void source_manager::remove(source_file *file) {
+  std::unique_lock<std::mutex> l(lock);
+  for (auto it = files.begin(); it != files.end(); ++it) {
+    if (it->get() != file) continue;
+    files.erase(it);
+    return;
+  }
+}
+
+
+source_file *source_manager::load(const std::string &path) {
+  auto buf = source_buffer::map_file(path.c_str());
+  if (buf == nullptr) return nullptr;
+  return add(buf, path);
+}
+
+
+source_file *source_manager::file_of(source_loc l) {
+  std::unique_lock<std::mutex> lk(lock);
+  // files are kept sorted by their base, so the owner is the last file
+  // starting at or before the location
+  auto it = std::upper_bound(
+      files.begin(), files.end(), l,
+      [](source_loc l, const std::unique_ptr<source_file> &f) {
+        return l < f->base();
+      });
+  if (it == files.begin()) return nullptr;
+  source_file *f = (it - 1)->get();
+  return f->contains(l) ? f : nullptr;
+}
+
+
+position source_manager::position_of(source_loc l, source_file **out) {
+  source_file *f = file_of(l);
+  if (out != nullptr) *out = f;
+  if (f == nullptr) return position();
+  return f->position_of(f->offset(l));
+}
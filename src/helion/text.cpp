@@ -24,9 +24,9 @@
 
 
 #include <helion/text.h>
-#include <codecvt>
-#include <iostream>
-#include <locale>
+#include <string.h>
+#include <algorithm>
+#include <limits>
 #include <string>
 
 
@@ -34,113 +34,243 @@
 using namespace helion;
 
 
-static std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> unicode_conv;
+// none of the conversions allocate or keep any state outside of the text
+// they're working on, so they're safe to use from several threads at once
 
-static std::string to_utf8(std::u32string const& s) {
-  return unicode_conv.to_bytes(s);
+void text::reserve_bytes(size_t need) {
+  if (need <= m_cap) return;
+  size_t cap = std::max(need, (size_t)m_cap * 2);
+  char *buf = new char[cap + 1];
+  memcpy(buf, m_data, m_size + 1);
+  if (m_data != m_inline) delete[] m_data;
+  m_data = buf;
+  m_cap = cap;
 }
 
-static std::u32string to_utf32(std::string const & s) {
-	return unicode_conv.from_bytes(s);
+
+// whether `s` points into this text's own bytes, which growing frees
+bool text::aliases(const char *s) const {
+  return s >= m_data && s <= m_data + m_size;
+}
+
+
+void text::append_valid(const char *s, size_t len, uint32_t runes) {
+  // appending a text to itself. The bytes are found again after growing
+  if (aliases(s)) {
+    size_t from = s - m_data;
+    reserve_bytes(m_size + len);
+    s = m_data + from;
+  } else {
+    reserve_bytes(m_size + len);
+  }
+  memcpy(m_data + m_size, s, len);
+  m_size += len;
+  m_data[m_size] = '\0';
+  m_length += runes;
+}
+
+
+void text::append_rune(rune r) {
+  char buf[utf8::max_width];
+  append_valid(buf, utf8::encode(r, buf), 1);
 }
 
 
-void text::ingest_utf8(std::string const& s) { buf = to_utf32(s); }
+void text::append_utf8(const char *s, size_t len) {
+  // replacing invalid bytes can grow it more than reserved, so a view of
+  // this text is copied out first
+  if (aliases(s)) {
+    std::string copy(s, len);
+    append_utf8(copy.data(), copy.size());
+    return;
+  }
+  reserve_bytes(m_size + len);
+  size_t i = 0;
+  while (i < len) {
+    // copy runs of ascii as they are
+    size_t run = i;
+    while (run < len && (unsigned char)s[run] < 0x80) run++;
+    if (run != i) {
+      append_valid(s + i, run - i, run - i);
+      i = run;
+      if (i == len) break;
+    }
+    // anything else goes through the codec, which replaces what isn't valid
+    size_t width;
+    append_rune(utf8::decode(s + i, len - i, width));
+    i += width;
+  }
+}
 
 
 text::text() {}
 
 
-text::text(const char* s) { ingest_utf8(std::string(s)); }
+text::text(const char* s) { append_utf8(s, strlen(s)); }
 
-text::text(char* s) { ingest_utf8(std::string(s)); }
+text::text(char* s) { append_utf8(s, strlen(s)); }
 
 
 text::text(const char32_t* s) {
-  buf.clear();
-  for (uint64_t l = 0; s[l] != '\0'; l++) {
-    buf.push_back(s[l]);
-  }
+  for (uint64_t l = 0; s[l] != '\0'; l++) append_rune(s[l]);
 }
 
-text::text(std::string const& s) { ingest_utf8(s); }
+text::text(const char* s, size_t len) { append_utf8(s, len); }
+
+text::text(std::string const& s) { append_utf8(s.data(), s.size()); }
 // copy constructor
 text::text(const helion::text& other) {
-  buf = other.buf;
-  return;
+  append_valid(other.m_data, other.m_size, other.m_length);
 }
 
+text::text(helion::text&& other) noexcept { *this = std::move(other); }
+
 
-text::text(std::u32string const& s) { buf = s; }
+text::text(std::u32string const& s) {
+  for (rune r : s) append_rune(r);
+}
 
 
 text& text::operator=(const text& o) {
-  buf = o.buf;
+  if (this == &o) return *this;
+  clear();
+  append_valid(o.m_data, o.m_size, o.m_length);
   return *this;
 }
 
 
-text::~text() {}
+text& text::operator=(text&& o) noexcept {
+  if (this == &o) return *this;
+  if (o.m_data != o.m_inline) {
+    // take the other's heap buffer
+    if (m_data != m_inline) delete[] m_data;
+    m_data = o.m_data;
+    m_cap = o.m_cap;
+    o.m_data = o.m_inline;
+    o.m_cap = inline_capacity;
+  } else {
+    // it fits in any buffer this already has
+    memcpy(m_data, o.m_data, o.m_size + 1);
+  }
+  m_size = o.m_size;
+  m_length = o.m_length;
+  o.m_size = o.m_length = 0;
+  o.m_data[0] = '\0';
+  return *this;
+}
+
+
+text::~text() {
+  if (m_data != m_inline) delete[] m_data;
+}
+
+
+text::iterator text::begin(void) const { return cbegin(); }
+text::iterator text::end(void) const { return cend(); }
 
+text::const_iterator text::cbegin(void) const {
+  return const_iterator(m_data, m_data + m_size);
+}
+text::const_iterator text::cend(void) const {
+  return const_iterator(m_data + m_size, m_data + m_size);
+}
+
+uint32_t text::size(void) const { return m_length; }
 
-text::iterator text::begin(void) { return buf.begin(); }
-text::iterator text::end(void) { return buf.end(); }
+uint32_t text::length(void) const { return m_length; }
 
-text::const_iterator text::cbegin(void) const { return buf.cbegin(); }
-text::const_iterator text::cend(void) const { return buf.cend(); }
+uint32_t text::max_size(void) const {
+  return std::numeric_limits<uint32_t>::max() - 1;
+}
+
+uint32_t text::capacity(void) const { return m_cap; }
 
-uint32_t text::size(void) { return buf.size(); }
+void text::clear(void) {
+  m_size = m_length = 0;
+  m_data[0] = '\0';
+}
 
-uint32_t text::length(void) { return buf.size(); }
+bool text::empty(void) const { return m_size == 0; }
 
-uint32_t text::max_size(void) { return buf.max_size(); }
 
-uint32_t text::capacity(void) { return buf.capacity(); }
+// the byte offset of the n'th code point
+static size_t offset_of(const char *s, size_t len, size_t n) {
+  size_t at = 0;
+  for (size_t i = 0; i < n && at < len; i++) {
+    size_t width = 1;
+    if ((unsigned char)s[at] >= 0x80) utf8::decode(s + at, len - at, width);
+    at += width;
+  }
+  return at;
+}
 
-void text::clear(void) { buf.clear(); }
 
-bool text::empty(void) { return buf.empty(); }
+void text::resize(uint32_t n, rune c) {
+  if (n >= m_length) {
+    while (m_length < n) append_rune(c);
+    return;
+  }
+  m_size = offset_of(m_data, m_size, n);
+  m_length = n;
+  m_data[m_size] = '\0';
+}
 
 
 text& text::operator+=(const text& other) {
-  for (auto it = other.cbegin(); it != other.cend(); it++) {
-    buf.push_back(*it);
-  }
+  append_valid(other.m_data, other.m_size, other.m_length);
   return *this;
 }
 
 
-text& text::operator+=(const char* other) { return operator+=(text(other)); }
+text& text::operator+=(const char* other) {
+  append_utf8(other, strlen(other));
+  return *this;
+}
+
 
+text& text::operator+=(std::string const& other) {
+  append_utf8(other.data(), other.size());
+  return *this;
+}
 
-text& text::operator+=(std::string const& other) { return operator+=(text(other)); }
+
+text& text::operator+=(std::string_view other) {
+  append_utf8(other.data(), other.size());
+  return *this;
+}
 
 
 text& text::operator+=(char c) {
-  buf.push_back(c);
+  append_rune((unsigned char)c);
   return *this;
 }
 text& text::operator+=(int c) {
-  buf.push_back(c);
+  append_rune(c);
   return *this;
 }
 
 text& text::operator+=(rune c) {
-  buf.push_back(c);
+  append_rune(c);
   return *this;
 }
 
-bool text::operator==(const text& other) { return other.buf == buf; }
-bool text::operator==(const text& other) const { return other.buf == buf; }
-
-
-text::operator std::string() const { return to_utf8(buf); }
-text::operator std::u32string() const { return buf; }
+bool text::operator==(const text& other) const { return view() == other.view(); }
 
-rune text::operator[](size_t i) { return buf[i]; }
 
-rune text::operator[](size_t i) const { return buf[i]; }
+text::operator std::string() const { return std::string(m_data, m_size); }
+text::operator std::u32string() const {
+  std::u32string out;
+  out.reserve(m_length);
+  for (rune r : *this) out.push_back(r);
+  return out;
+}
 
-void text::push_back(rune& r) { buf.push_back(r); }
+rune text::operator[](size_t i) const {
+  // every code point is a byte in ascii text
+  if (m_length == m_size) return (unsigned char)m_data[i];
+  size_t at = offset_of(m_data, m_size, i);
+  size_t width;
+  return utf8::decode(m_data + at, m_size - at, width);
+}
 
-void text::push_back(rune&& r) { buf.push_back(r); }
+void text::push_back(rune r) { append_rune(r); }
@@ -0,0 +1,60 @@
+// [License]
+// MIT - See LICENSE.md file in the package.
+
+#include <helion/thread_pool.h>
+
+using namespace helion;
+
+
+static thread_local bool is_worker = false;
+
+
+
+thread_pool::thread_pool(size_t n) {
+  if (n == 0) n = std::thread::hardware_concurrency();
+  if (n == 0) n = 1;
+  workers.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    workers.emplace_back([this] { work(); });
+  }
+}
+
+
+
+thread_pool::~thread_pool() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers) w.join();
+}
+
+
+
+void thread_pool::work(void) {
+  is_worker = true;
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> l(lock);
+      wake.wait(l, [this] { return stopping || !jobs.empty(); });
+      // drain the queue before honoring a stop request
+      if (jobs.empty()) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+
+
+thread_pool &thread_pool::global(void) {
+  static thread_pool pool;
+  return pool;
+}
+
+
+
+bool thread_pool::on_worker(void) { return is_worker; }
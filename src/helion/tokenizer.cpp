@@ -22,10 +22,14 @@
  * SOFTWARE.
  */
 
+#include <helion/scan.h>
 #include <helion/text.h>
 #include <helion/tokenizer.h>
 #include <helion/util.h>
 #include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <future>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -33,91 +37,320 @@
 
 using namespace helion;
 
+// character classes, the operator DFA and the keyword hash table
+#include <helion/lexer_tables.inc>
 
-static auto is_space(rune c) { return c == ' ' || c == '\t'; }
 
-token::token(uint8_t t, text v, std::shared_ptr<text> src, size_t l, size_t c) {
-  type = t;
-  val = v;
-  source = src;
-  line = l;
-  col = c;
+static inline bool has_class(rune c, uint8_t cls) {
+  return c < 0x80 && (char_classes[c] & cls) != 0;
 }
 
-tokenizer::tokenizer(text src, text pa) {
-  path = pa;
-  source = std::make_shared<text>(src);
-  tokens = std::make_shared<std::vector<token>>();
+static auto is_space(rune c) { return has_class(c, cc_space); }
+
+static auto is_digit(rune c) { return has_class(c, cc_digit); }
+
+// can this rune be part of a run of operator characters?
+static bool is_operator_rune(rune c) {
+  if (c < 0x80) return char_classes[c] & cc_op;
+  for (auto r : operator_runes) {
+    if (r == c) return true;
+  }
+  return false;
+}
+
+
+// the basic C escape codes
+static const std::map<char, char> esc_mappings = {
+    {'a', 0x07}, {'b', 0x08},  {'f', 0x0C}, {'n', 0x0A},
+    {'r', 0x0D}, {'t', 0x09},  {'v', 0x0B}, {'\\', 0x5C},
+    {'"', 0x22}, {'\'', '\''}, {'e', 0x1B},
+};
+
+
+/**
+ * decode the contents of a string literal, resolving escape sequences. The
+ * literal has already been validated by the lexer.
+ */
+static text unescape(const char *s, size_t len) {
+  text buf;
+  size_t i = 0;
+  while (i < len) {
+    size_t width;
+    rune c = utf8::decode(s + i, len - i, width);
+    i += width;
+    if (c == '\\' && i < len) {
+      char e = s[i++];
+      if (e == 'U' || e == 'u') {
+        size_t l = e == 'u' ? 4 : 8;
+        c = (rune)std::stoul(std::string(s + i, l), nullptr, 16);
+        i += l;
+      } else {
+        c = esc_mappings.at(e);
+      }
+    }
+    buf += c;
+  }
+  return buf;
+}
+
+/**
+ * register a source that's only read by the tokenizers holding on to it. It
+ * goes in a range of its own, and is unloaded and the range given back once
+ * the last of them is gone, so throwaway parses don't keep their text loaded
+ * or use up locations
+ */
+static std::shared_ptr<source_file> add_scoped(std::shared_ptr<source_buffer> buf,
+                                               std::string path) {
+  auto &mgr = source_manager::global();
+  source_loc base = mgr.reserve(buf->size() + 1);
+  source_file *f;
+  try {
+    f = mgr.adopt(source_manager::make(std::move(buf), std::move(path), base));
+  } catch (...) {
+    mgr.release(base);
+    throw;
+  }
+  return std::shared_ptr<source_file>(f, [base](source_file *f) {
+    auto &mgr = source_manager::global();
+    mgr.remove(f);
+    mgr.release(base);
+  });
+}
+
+
+tokenizer::tokenizer(text src, text pa)
+    : tokenizer(source_buffer::from_string(src), pa) {}
+
+
+tokenizer::tokenizer(std::shared_ptr<source_buffer> src, text pa)
+    : tokenizer(add_scoped(std::move(src), pa)) {}
+
+
+tokenizer::tokenizer(std::shared_ptr<source_file> owned)
+    : tokenizer(owned.get()) {
+  scoped = std::move(owned);
+}
+
+
+tokenizer::tokenizer(source_file *f) {
+  file = f;
+  path = f->path();
+  source = f->buffer();
   index = 0;
+  // the pool is checked here, as the first token may be asked for elsewhere
+  parallel = source->size() >= parallel_threshold && !thread_pool::on_worker();
 }
 
 
+tokenizer::tokenizer(source_file *f, size_t start) {
+  file = f;
+  path = f->path();
+  source = f->buffer();
+  index = start;
+}
+
+
+tokenizer::tokenizer(tokenizer &old, source_file *f, size_t offset,
+                     size_t removed, size_t inserted, token_splice &splice)
+    : tokenizer(f, 0) {
+  splice = token_splice();
+  // a streaming tokenizer doesn't have the old tokens to copy anymore
+  if (old.base != 0) return;
+#ifndef DO_INDENT
+  // copy the tokens that end before the edit. Lexing only looks at the byte
+  // before where it starts, so picking up after them lexes the same tokens
+  // an edit-free lex would. The indentation state runs through the whole
+  // file, so with it everything is lexed again
+  size_t lo = 0, hi = old.kinds.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (old.end_of(mid) < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  splice.prefix = lo;
+
+  auto copy = [&](size_t from, size_t to, ptrdiff_t shift) {
+    for (size_t t = from; t < to; t++) {
+      kinds.push_back(old.kinds[t]);
+      spaced.push_back(old.spaced[t]);
+      lengths.push_back(old.lengths[t]);
+      locs.push_back(file->loc(old.file->offset(old.locs[t]) + shift));
+      atoms.push_back(old.atoms[t]);
+    }
+  };
+  copy(0, splice.prefix, 0);
+  if (splice.prefix > 0) index = old.end_of(splice.prefix - 1);
+
+  // lex through the edit until lexing stops somewhere it stopped in the old
+  // stream. The byte before that has to be past the edit too, and from
+  // there on the old tokens are the right ones, just moved over
+  ptrdiff_t shift = (ptrdiff_t)inserted - (ptrdiff_t)removed;
+  size_t edit_end = offset + inserted;
+  while (!done) {
+    if (index > edit_end) {
+      size_t from = old.resume_point(index - shift);
+      if (from != (size_t)-1) {
+        splice.suffix_old = from;
+        splice.suffix_new = kinds.size();
+        copy(from, old.kinds.size(), shift);
+        index = old.index + shift;
+        done = old.done;
+        break;
+      }
+      // the old stream was never lexed this far, so the rest is lexed lazily
+      if (index - shift > old.index) break;
+    }
+    lex();
+  }
+#endif
+}
+
+
+
+bool tokenizer::lex_more() {
+  if (done) return false;
+  if (parallel) {
+    parallel = false;
+    if (!streaming) {
+      lex_parallel(thread_pool::global());
+      return true;
+    }
+  }
+  lex();
+  return true;
+}
+
+
+void tokenizer::commit(size_t i) {
+  // a skipped def body is parsed from its tokens later on
+  if (!streaming || lazy_bodies || i <= base) return;
+  size_t drop = std::min(i - base, kinds.size());
+  kinds.erase(kinds.begin(), kinds.begin() + drop);
+  spaced.erase(spaced.begin(), spaced.begin() + drop);
+  lengths.erase(lengths.begin(), lengths.begin() + drop);
+  locs.erase(locs.begin(), locs.begin() + drop);
+  atoms.erase(atoms.begin(), atoms.begin() + drop);
+  base += drop;
+  // the memo is keyed by token index, and is mostly about released tokens
+  memo.clear();
+}
+
 
 token tokenizer::get(size_t i) {
   if ((int)i < 0) {
-    return token(tok_eof, "", nullptr, 0, 0);
+    return token();
   }
+  if (i > furthest) furthest = i;
 
-  if (i >= tokens->size()) {
-    if (!done) {
-      lex();
-      return get(i);
-    } else {
-      return token(tok_eof, "", nullptr, 0, 0);
-    }
+  while (i - base >= kinds.size()) {
+    if (i < base) throw std::logic_error("token was released by commit");
+    if (!lex_more()) return token();
   }
-  return tokens->at(i);
+  i -= base;
+
+  token tok;
+  tok.type = kinds[i];
+  tok.space_before = spaced[i];
+  tok.offset = file->offset(locs[i]);
+  tok.length = lengths[i];
+  tok.loc = locs[i];
+  return tok;
 }
 
 
+uint8_t tokenizer::kind(size_t i) {
+  if ((int)i < 0) return tok_eof;
+  if (i > furthest) furthest = i;
+  while (i - base >= kinds.size()) {
+    if (i < base) throw std::logic_error("token was released by commit");
+    if (!lex_more()) return tok_eof;
+  }
+  return kinds[i - base];
+}
 
-token tokenizer::emit(uint8_t t, text v) {
-  token tok(t, v, source, line, column);
 
+atom tokenizer::atom_at(size_t i) {
+  if (kind(i) == tok_eof) return atom();
+  return atom::from_id(atoms[i - base]);
+}
+
+
+
+token tokenizer::emit(uint8_t t, size_t start) {
+  return emit(t, start, index);
+}
 
-  if (last_emit_ended != -1) {
-    if (is_space(source->operator[](last_emit_ended - 1))) {
+token tokenizer::emit(uint8_t t, size_t start, size_t end) {
+  token tok;
+  tok.type = t;
+  tok.offset = start;
+  tok.length = end - start;
+  tok.loc = file->loc(start);
+
+
+  if (last_emit_ended > 0) {
+    if (is_space((*source)[last_emit_ended - 1])) {
       tok.space_before = true;
     }
   }
 
 
   last_emit_ended = index;
-  tokens->push_back(tok);
+  kinds.push_back(tok.type);
+  spaced.push_back(tok.space_before);
+  lengths.push_back(tok.length);
+  locs.push_back(tok.loc);
+  atoms.push_back(0);
   return tok;
 }
 
 
+text tokenizer::value(const token &tok) {
+  if (tok.type == tok_str)
+    return unescape(source->data() + tok.offset, tok.length);
+  return text(source->data() + tok.offset, tok.length);
+}
+
+std::string_view tokenizer::bytes(const token &tok) {
+  return std::string_view(source->data() + tok.offset, tok.length);
+}
+
+position tokenizer::position_of(const token &tok) {
+  if (!file->contains(tok.loc)) return position();
+  return file->position_of(file->offset(tok.loc));
+}
+
+
 rune tokenizer::next() {
-  auto c = peek();
-  // increment book-keeping information
-  index++;
-  column++;
-  if (c == '\n') {
-    line++;
-    column = 0;
+  if (index >= source->size()) return -1;
+
+  // ascii is the common case, so only run the decoder on multibyte runes
+  size_t width = 1;
+  rune c = (unsigned char)(*source)[index];
+  if (c >= 0x80) {
+    c = utf8::decode(source->data() + index, source->size() - index, width);
   }
+
+  // lines and columns aren't tracked here, the source_file works them out
+  // from a token's location only when they are asked for
+  index += width;
   return c;
 }
 
 rune tokenizer::peek() {
-  if (index > source->size()) {
+  if (index >= source->size()) {
     return -1;
   }
-  return source->operator[](index);
+  rune c = (unsigned char)(*source)[index];
+  if (c < 0x80) return c;
+  size_t width;
+  return utf8::decode(source->data() + index, source->size() - index, width);
 }
 
-bool in_charset(rune c, const text set) {
-  for (int i = 0; set[i]; i++) {
-    if (set[i] == c) return true;
-  }
-  return false;
-}
-
-
-
 static auto in_set(text &set, rune c) {
-  for (auto &n : set) {
+  for (rune n : set) {
     if (n == c) return true;
   }
   return false;
@@ -134,7 +367,7 @@ top:
    * a lambda function that accepts as long as the next rune is
    * in the set of runes supplied by the parameter `set`
    */
-  auto accept_run = [&](text set) {
+  [[maybe_unused]] auto accept_run = [&](text set) {
     text buf;
     while (in_set(set, peek())) {
       buf += next();
@@ -148,7 +381,7 @@ top:
   /**
    * handle indentation and dedents.
    * single newline lines are removed by the newline parser.
-   * if we get here, and the column == 0, we need to check if we indent
+   * if we get here at the start of a line, we need to check if we indent
    * or dedent.
    */
   if (group_depth == 0) {
@@ -156,18 +389,18 @@ top:
       depth_delta--;
       depth++;
       // printf("INDENT\n");
-      return emit(tok_indent);
+      return emit(tok_indent, index);
     }
     if (depth > 0) {
       if (depth_delta < 0) {
         depth_delta++;
         depth--;
         // printf("DEDENT\n");
-        return emit(tok_dedent);
+        return emit(tok_dedent, index);
       }
     }
 
-    if (column == 0) {
+    if (index == 0 || (*source)[index - 1] == '\n') {
       // if the depth is 0, we have no indentation. Therefore we need to check
       // for indentation and possibly make that indentation the new indent text
       if (depth == 0) {
@@ -218,6 +451,14 @@ top:
 #endif
 
 
+  // runs of spaces are skipped in bulk. They are always single byte runes
+  {
+    const char *p = source->data() + index;
+    index = scan::skip_spaces(p, source->data() + source->size()) - source->data();
+    last_emit_ended = index;
+  }
+
+  size_t start = index;
   int32_t c = next();
 
   // std::cout << "LINE:" << get_line(index) << std::endl;
@@ -226,20 +467,32 @@ top:
 
   // newlines and semicolons are considered 'terminator' characters.
   // they signify the end of a line or other construct
-  if (c == '\n' || c == ';') {
-    while (peek() == '\n' || peek() == ';') {
+  if (has_class(c, cc_term)) {
+    while (has_class(peek(), cc_term)) {
       c = next();
     }
     /*  if (group_depth != 0) {
      *    goto top;
      *  }
      */
-    return emit(tok_term, ";");
+    return emit(tok_term, start);
   }
 
   if (c == '#') {
-    while (peek() != '\n' && (int32_t)peek() != -1) next();
-    if (peek() == '\n') accept_run("\n");
+    // a comment runs to the end of the line, and the newlines after it are
+    // dropped. Consecutive comment lines are skipped in one go, as generated
+    // sources tend to have large blocks of them
+    const char *src = source->data();
+    const char *end = src + source->size();
+    const char *p = src + index;
+    while (true) {
+      p = scan::find_newline(p, end);
+      while (p < end && *p == '\n') p++;
+      const char *q = scan::skip_spaces(p, end);
+      if (q == end || *q != '#') break;
+      p = q + 1;
+    }
+    index = p - src;
     goto top;
   }
 
@@ -250,13 +503,13 @@ top:
     // grammar
     if (depth > 0) {
       depth--;
-      return emit(tok_dedent, "");
+      return emit(tok_dedent, index);
     }
     /**
      * this is where the tokenizer could be considered done
      */
     done = true;
-    return emit(tok_eof, "");
+    return emit(tok_eof, index);
   }
 
 
@@ -270,94 +523,70 @@ top:
   }
 
 
-  // the basic C escape codes
-  static std::map<char, char> esc_mappings = {
-      {'a', 0x07}, {'b', 0x08},  {'f', 0x0C}, {'n', 0x0A},
-      {'r', 0x0D}, {'t', 0x09},  {'v', 0x0B}, {'\\', 0x5C},
-      {'"', 0x22}, {'\'', '\''}, {'e', 0x1B},
-  };
-
-
-
   if (c == '(') {
     group_depth++;
-    return emit(tok_left_paren, "(");
+    return emit(tok_left_paren, start);
   }
   if (c == ')') {
     group_depth--;
-    return emit(tok_right_paren, ")");
+    return emit(tok_right_paren, start);
   }
 
 
   if (c == '[') {
     group_depth++;
-    return emit(tok_left_square, "[");
+    return emit(tok_left_square, start);
   }
   if (c == ']') {
     group_depth--;
-    return emit(tok_right_square, "]");
+    return emit(tok_right_square, start);
   }
   if (c == '{') {
     group_depth++;
-    return emit(tok_left_curly, "{");
+    return emit(tok_left_curly, start);
   }
   if (c == '}') {
     group_depth--;
-    return emit(tok_right_curly, "}");
+    return emit(tok_right_curly, start);
   }
 
 
-  if (c == ',') return emit(tok_comma, ",");
+  if (c == ',') return emit(tok_comma, start);
 
 
   if (c == '"' || c == '\'') {
-    bool double_quotes = c == '"';
+    rune quote = c;
 
-    text buf;
-
-    bool escaped = false;
-    // ignore the first quote because a string shouldn't
-    // contain the encapsulating quotes in it's internal representation
+    // the token only records the bytes between the quotes. Escapes are
+    // validated here, but are only decoded when the value is asked for
     while (true) {
       c = next();
       if ((int32_t)c == -1) throw std::logic_error("unterminated string");
-      if (c == (double_quotes ? '"' : '\'')) break;
-      escaped = c == '\\';
-      if (escaped) {
+      if ((rune)c == quote) break;
+      if (c == '\\') {
         char e = next();
         if (e == 'U' || e == 'u') {
-          std::string hex;
           int l = 8;
           if (e == 'u') l = 4;
           for (int i = 0; i < l; i++) {
-            hex += next();
-          }
-          std::cout << hex << std::endl;
-          c = (int32_t)std::stoul(hex, nullptr, 16);
-          printf("%u\n", c);
-        } else {
-          c = esc_mappings[e];
-          if (c == 0) {
-            throw std::logic_error("unknown escape sequence in string");
+            if (!isxdigit(next()))
+              throw std::logic_error("invalid unicode escape in string");
           }
+        } else if (esc_mappings.count(e) == 0) {
+          throw std::logic_error("unknown escape sequence in string");
         }
-        escaped = false;
       }
-      buf += c;
     }
-    return emit(tok_str, buf);
+    return emit(tok_str, start + 1, index - 1);
   }
 
 
 
 
   // parse a number
-  if (isdigit(c) || c == '.' || (c == '-' && isdigit(peek()))) {
+  if (is_digit(c) || c == '.' || (c == '-' && is_digit(peek()))) {
     // it's a number (or it should be) so we should parse it as such
 
-    text buf;
-
-    buf += c;
     // bool has_decimal = c == '.';
 
 
@@ -390,138 +619,243 @@ top:
     */
 
 
-    while (isdigit(peek()) || peek() == '.') {
-      c = next();
-      buf += c;
+    while (is_digit(peek()) || peek() == '.') {
+      next();
     }
 
-    if (!(buf == ".")) {
-      return emit(tok_num, buf);
+    if (!(c == '.' && index - start == 1)) {
+      return emit(tok_num, start);
     } else {
-      return emit(tok_dot, ".");
+      return emit(tok_dot, start);
     }
   }  // digit parsing
 
 
 
 
-  // operator parsing
-  static text operators = "?&\\*+-/%!=<>≤≥≠.←|&^";
-
-
-
-  static std::map<std::string, uint8_t> op_mappings = {
-      {"=", tok_assign},  {"==", tok_equal},   {"!=", tok_notequal},
-      {">", tok_gt},      {">=", tok_gte},     {"<", tok_lt},
-      {"<=", tok_lte},    {"+", tok_add},      {"-", tok_sub},
-      {"*", tok_mul},     {"/", tok_div},      {".", tok_dot},
-      {"->", tok_arrow},  {"|", tok_pipe},     {",", tok_comma},
-      {"%", tok_mod},     {"::", tok_is_type}, {":", tok_colon},
-      {"?", tok_question}};
-
-
-  if (in_charset(c, operators)) {
-    std::string op;
-    op += c;
-
-    while (in_charset(peek(), operators)) {
-      auto v = next();
-      if ((rune)v == (rune)-1 || v == 0) break;
-      op += v;
+  // operator parsing. Operators are the longest run of operator characters,
+  // which is fed through the generated operator DFA as it is consumed
+  if (is_operator_rune(c)) {
+    uint8_t state = c < 0x80 ? op_dfa[1][op_columns[c]] : 0;
+    while (is_operator_rune(peek())) {
+      rune v = next();
+      state = v < 0x80 ? op_dfa[state][op_columns[v]] : 0;
     }
 
-
-    if (op_mappings.count(op) != 0) {
-      auto t = op_mappings[op];
-      return emit(t, op);
+    if (op_dfa_accept[state] != 0xFF) {
+      return emit(op_dfa_accept[state], start);
     } else {
       std::string e;
       e += "invalid operator: ";
-      e += op;
+      e += std::string(source->data() + start, index - start);
       throw std::logic_error(e.c_str());
     }
   }
 
-  // now all we can do is parse ids and keywords
-
-
-  text symbol;
-  symbol += c;
-
-  while (!in_charset(peek(), " ;\n\t(){}[],") &&
-         !in_charset(peek(), operators)) {
-    auto v = next();
-    if ((int32_t)v == -1 || v == 0) break;
-    symbol += v;
+  // now all we can do is parse ids and keywords. Symbols end at a delimiter
+  // or an operator character, which the class table answers per byte. Only
+  // a lead byte of a non-ascii operator rune needs to be decoded.
+  const char *src = source->data();
+  while (index < source->size()) {
+    // the common identifier bytes are skipped in bulk, anything else is
+    // classified one byte at a time
+    index = scan::skip_word(src + index, src + source->size()) - src;
+    if (index >= source->size()) break;
+
+    uint8_t b = src[index];
+    uint8_t cls = char_classes[b];
+    if ((cls & (cc_delim | cc_op)) || b == 0) break;
+    if ((cls & cc_op_lead) && is_operator_rune(peek())) break;
+    index++;
   }
 
-  if (symbol.length() == 0)
-    throw std::logic_error("lexer encountered zero-length identifier");
-
   uint8_t type = tok_var;
+  size_t symbol_start = start;
 
-  if (symbol[0] == ':') {
-    if (symbol.size() == 1) return emit(tok_colon, ":");
+  if (c == ':') {
+    if (index - start == 1) return emit(tok_colon, start);
     type = tok_keyword;
   } else {
     // TODO(unicode)
-    if (symbol[0] >= 'A' && symbol[0] <= 'Z') {
+    if (has_class(c, cc_upper)) {
       type = tok_type;
     }
-    if (symbol[0] == '@') {
-      text s;
-      for (uint32_t i = 1; i < symbol.size(); i++) {
-        s += symbol[i];
-      }
-      symbol = s;
-      if (s.size() == 0) throw std::logic_error("invalid @ symbol syntax.");
+    if (c == '@') {
+      symbol_start++;
+      if (index == symbol_start)
+        throw std::logic_error("invalid @ symbol syntax.");
       type = tok_self_var;
     }
   }
 
   // absorb question marks into symbols but not into types
   if (type != tok_type) {
-    while (peek() == '?') {
-      auto v = next();
-      if ((int32_t)v == -1 || v == 0) break;
-      symbol += v;
+    while (peek() == '?') next();
+  }
+
+  // keywords are found with the generated perfect hash
+  size_t len = index - symbol_start;
+  auto &kw = keyword_table[keyword_hash(src + symbol_start, len)];
+  if (kw.length == len && memcmp(kw.spelling, src + symbol_start, len) == 0) {
+    type = kw.type;
+  }
+
+  // identifiers are interned as they are lexed, so everything after the
+  // lexer can compare names by id
+  token tok = emit(type, symbol_start);
+  if (type == tok_var || type == tok_type || type == tok_self_var) {
+    atoms.back() = atom(bytes(tok)).id();
+  }
+  return tok;
+}
+
+
+
+bool tokenizer::lex_until(size_t stop) {
+  while (!done && index < stop) {
+    // lex() only emits once a token is known to be good, so rewinding the
+    // position is enough to undo a failed token
+    size_t i = index;
+    int g = group_depth;
+    try {
+      lex();
+    } catch (std::exception &) {
+      index = i;
+      group_depth = g;
+      return false;
     }
   }
+  return true;
+}
+
+
+size_t tokenizer::end_of(size_t t) {
+  // string tokens don't include their closing quote
+  return file->offset(locs[t]) + lengths[t] + (kinds[t] == tok_str ? 1 : 0);
+}
 
 
-  static std::map<std::string, uint8_t> special_token_type_map = {
-      {"::", tok_is_type},  {"def", tok_def},         {"or", tok_or},
-      {"let", tok_let},     {"const", tok_const},     {"global", tok_global},
-      {"some", tok_some},   {"and", tok_and},         {"not", tok_not},
-      {"do", tok_do},       {"if", tok_if},           {"then", tok_then},
-      {"else", tok_else},   {"elif", tok_elif},       {"for", tok_for},
-      {"while", tok_while}, {"return", tok_return},   {"type", tok_typedef},
-      {"end", tok_end},     {"extends", tok_extends}, {"nil", tok_nil}};
-  if (special_token_type_map.count(symbol) != 0) {
-    type = special_token_type_map[symbol];
+size_t tokenizer::resume_point(size_t at) {
+  size_t lo = 0, hi = kinds.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (end_of(mid) < at)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  if (lo < kinds.size() && end_of(lo) == at) return lo + 1;
+  return -1;
+}
+
+
+void tokenizer::adopt(tokenizer &chunk, size_t from) {
+  // chunks lex the same source_file, so their locations are already right
+  kinds.insert(kinds.end(), chunk.kinds.begin() + from, chunk.kinds.end());
+  spaced.insert(spaced.end(), chunk.spaced.begin() + from, chunk.spaced.end());
+  lengths.insert(lengths.end(), chunk.lengths.begin() + from,
+                 chunk.lengths.end());
+  locs.insert(locs.end(), chunk.locs.begin() + from, chunk.locs.end());
+  atoms.insert(atoms.end(), chunk.atoms.begin() + from, chunk.atoms.end());
 
-  return emit(type, symbol);
+  index = chunk.index;
+  last_emit_ended = chunk.last_emit_ended;
+  done = chunk.done;
 }
 
 
+void tokenizer::lex_parallel(thread_pool &pool) {
+#ifdef DO_INDENT
+  // the indentation state runs through the whole file, so it can't be lexed
+  // in independent pieces
+  return;
+#endif
+  if (!kinds.empty() || done) return;
+
+  // chunks smaller than this aren't worth the thread handoff
+  const size_t min_chunk = 1 << 20;
+  const char *src = source->data();
+  const char *end = src + source->size();
+
+  // this thread lexes the first chunk, so one chunk per worker keeps every
+  // core busy. A single core machine is better off lexing serially
+  size_t want = std::min(pool.size(), source->size() / min_chunk);
+  if (want < 2) return;
+
+  // split at the start of lines that begin in the first column with
+  // something other than a comment. Those are top level code in any sane
+  // file, though a chunk can still start inside a multiline string or
+  // group. There is no cheap way to rule that out, as quotes and '#' are
+  // ordinary symbol bytes mid token, so it is caught below instead
+  std::vector<size_t> starts = {0};
+  for (size_t k = 1; k < want; k++) {
+    const char *p = src + std::max(k * source->size() / want, starts.back());
+    while (p < end) {
+      p = scan::find_newline(p, end);
+      while (p < end && has_class((unsigned char)*p, cc_term)) p++;
+      if (p < end && p[-1] == '\n' && !has_class((unsigned char)*p, cc_space) &&
+          *p != '#')
+        break;
+    }
+    if (p >= end) break;
+    starts.push_back(p - src);
+  }
+  starts.push_back(source->size());
+
+  size_t count = starts.size() - 1;
+  if (count < 2) return;
+
+  // every chunk after the first is lexed on the pool by its own tokenizer
+  std::vector<std::unique_ptr<tokenizer>> chunks;
+  std::vector<std::future<bool>> lexed;
+  for (size_t k = 1; k < count; k++) {
+    chunks.emplace_back(new tokenizer(file, starts[k]));
+    tokenizer *c = chunks.back().get();
+    size_t stop = starts[k + 1];
+    lexed.push_back(pool.submit([c, stop] { return c->lex_until(stop); }));
+  }
 
-text tokenizer::get_line(long want) {
-  text &src = *source;
-  text s;
-  int cln = 0;
-  size_t ind = 0;
-
-  while (cln < want && ind < src.size()) {
-    if (src[ind++] == '\n') {
-      cln++;
+  // the first chunk is lexed right here, directly into this tokenizer
+  bool ok = lex_until(starts[1]);
+
+  for (size_t k = 1; k < count; k++) {
+    bool chunk_ok = lexed[k - 1].get();
+    // after an error the rest is lexed lazily, which raises it in order
+    if (!ok || done) continue;
+
+    // adopt the chunk's tokens from the first place both token streams
+    // stopped lexing at the same byte. Lexing from there on is the same no
+    // matter where it started, so the rest of the chunk is right. If the
+    // streams never meet, the chunk started inside a token and is dropped
+    tokenizer &c = *chunks[k - 1];
+    while (!done) {
+      size_t from = -1;
+      if (index == starts[k]) {
+        from = 0;
+      } else if (index > starts[k]) {
+        from = c.resume_point(index);
+      }
+
+      if (from != (size_t)-1) {
+        adopt(c, from);
+        ok = chunk_ok;
+        break;
+      }
+      if (index >= c.index) break;
+      if (!lex_until(index + 1)) ok = false;
+      if (!ok) break;
     }
   }
-  if (ind == src.size() - 1) {
+}
+
+
+
+text tokenizer::get_line(long want) {
+  if (want < 0 || (size_t)want >= file->line_count()) {
     return "unable to find line!";
   }
-  while (ind < src.size() && src[ind] != '\n') s += src[ind++];
-  return s;
+  auto line = file->line_text(want);
+  return text(line.data(), line.size());
 }
 
 
@@ -64,7 +64,239 @@ tokens = [
 ]
 
 
+# the spelling of every keyword, mapped to the token it lexes as. Symbols are
+# looked up in a perfect hash of these after they are lexed
+keywords = {
+    "::": "is_type",
+    "def": "def",
+    "or": "or",
+    "let": "let",
+    "const": "const",
+    "global": "global",
+    "some": "some",
+    "and": "and",
+    "not": "not",
+    "do": "do",
+    "if": "if",
+    "then": "then",
+    "else": "else",
+    "elif": "elif",
+    "for": "for",
+    "while": "while",
+    "return": "return",
+    "type": "typedef",
+    "end": "end",
+    "extends": "extends",
+    "nil": "nil",
+}
+
+# every spelling an operator can have. Operators are lexed as the longest run
+# of operator characters, which then must be one of these
+operators = {
+    "=": "assign",
+    "==": "equal",
+    "!=": "notequal",
+    ">": "gt",
+    ">=": "gte",
+    "<": "lt",
+    "<=": "lte",
+    "+": "add",
+    "-": "sub",
+    "*": "mul",
+    "/": "div",
+    ".": "dot",
+    "->": "arrow",
+    "|": "pipe",
+    "%": "mod",
+    "?": "question",
+}
+
+# binary operators by token: their precedence, higher binds tighter, and
+# whether they associate to the right
+binary_operators = {
+    "assign": (0, "right"),
+    "equal": (2, "left"),
+    "notequal": (2, "left"),
+    "lt": (10, "left"),
+    "lte": (10, "left"),
+    "gt": (10, "left"),
+    "gte": (10, "left"),
+    "add": (20, "left"),
+    "sub": (20, "left"),
+    "mul": (40, "left"),
+    "div": (40, "left"),
+    "mod": (40, "left"),
+}
+
+# characters that make up runs of operators. The non-ascii ones are reserved,
+# they terminate symbols but don't spell any operator yet.
+operator_chars = "?&\\*+-/%!=<>.|^"
+operator_runes = "≤≥≠←"
+
+# characters that always end a symbol
+delimiter_chars = " ;\n\t(){}[],"
+
 
 with open('include/helion/tokens.inc', 'w') as f:
     for i, tok in enumerate(tokens):
         f.write(f'TOKEN(tok_{tok}, {i}, "{tok}")\n')
+
+
+
+
+def write_rows(f, vals, per_row=16):
+    for i in range(0, len(vals), per_row):
+        row = ', '.join(f'{v:3}' for v in vals[i:i + per_row])
+        f.write(f'    /* {i:3} */ {row},\n')
+
+
+def perfect_hash(words):
+    """
+    find a hash of the form (len * a + first * b + last) % size with no
+    collisions over `words`, preferring the smallest table
+    """
+    size = 1
+    while size < len(words):
+        size *= 2
+    while True:
+        for a in range(1, 64):
+            for b in range(1, 64):
+                slots = {}
+                for w in words:
+                    bs = w.encode('utf-8')
+                    h = (len(bs) * a + bs[0] * b + bs[-1]) % size
+                    if h in slots:
+                        break
+                    slots[h] = w
+                else:
+                    return size, a, b, slots
+        size *= 2
+
+
+def operator_dfa(ops):
+    """
+    build a trie shaped DFA over the operator spellings. State 0 is the dead
+    state and state 1 is the start state.
+    """
+    chars = sorted(set(operator_chars))
+    trans = [[0] * (len(chars) + 1), [0] * (len(chars) + 1)]
+    accept = ['0xFF', '0xFF']
+    for op, tok in sorted(ops.items()):
+        state = 1
+        for c in op:
+            col = chars.index(c) + 1
+            if trans[state][col] == 0:
+                trans.append([0] * (len(chars) + 1))
+                accept.append('0xFF')
+                trans[state][col] = len(trans) - 1
+            state = trans[state][col]
+        accept[state] = f'tok_{tok}'
+    return chars, trans, accept
+
+
+
+with open('include/helion/lexer_tables.inc', 'w') as f:
+    f.write('// generated by tools/scripts/generate_tokens.py. DO NOT MODIFY\n')
+    f.write('// included by src/helion/tokenizer.cpp\n\n')
+
+    # character classes of every byte
+    f.write('enum char_class : uint8_t {\n')
+    f.write('  cc_space = 1 << 0,\n')
+    f.write('  cc_term = 1 << 1,\n')
+    f.write('  cc_digit = 1 << 2,\n')
+    f.write('  cc_op = 1 << 3,\n')
+    f.write('  cc_delim = 1 << 4,\n')
+    f.write('  cc_upper = 1 << 5,\n')
+    f.write('  // a lead byte that may start a reserved non-ascii operator rune\n')
+    f.write('  cc_op_lead = 1 << 6,\n')
+    f.write('};\n\n')
+
+    op_leads = set(c.encode('utf-8')[0] for c in operator_runes)
+    classes = []
+    for b in range(256):
+        c = chr(b)
+        cls = 0
+        if b < 128:
+            if c in ' \t': cls |= 1 << 0
+            if c in '\n;': cls |= 1 << 1
+            if c.isdigit(): cls |= 1 << 2
+            if c in operator_chars: cls |= 1 << 3
+            if c in delimiter_chars: cls |= 1 << 4
+            if 'A' <= c <= 'Z': cls |= 1 << 5
+        if b in op_leads: cls |= 1 << 6
+        classes.append(cls)
+
+    f.write('static constexpr uint8_t char_classes[256] = {\n')
+    write_rows(f, classes)
+    f.write('};\n\n')
+
+    f.write('static constexpr rune operator_runes[] = {\n')
+    for c in operator_runes:
+        f.write(f'    0x{ord(c):04X},  // {c}\n')
+    f.write('};\n\n')
+
+    # operator DFA
+    chars, trans, accept = operator_dfa(operators)
+    f.write('// column of each ascii operator character in the operator DFA. Zero\n')
+    f.write('// is any character that cannot be in an operator\n')
+    f.write('static constexpr uint8_t op_columns[128] = {\n')
+    write_rows(f, [chars.index(chr(b)) + 1 if chr(b) in chars else 0
+                   for b in range(128)])
+    f.write('};\n\n')
+
+    f.write(f'static constexpr int op_dfa_columns = {len(chars) + 1};\n')
+    f.write('// transitions of the operator DFA. State 0 is dead, state 1 is the start\n')
+    f.write(f'static constexpr uint8_t op_dfa[{len(trans)}][op_dfa_columns] = {{\n')
+    for row in trans:
+        f.write('    {' + ', '.join(str(x) for x in row) + '},\n')
+    f.write('};\n\n')
+    f.write('// the token type each state accepts, or 0xFF if it is not accepting\n')
+    f.write(f'static constexpr uint8_t op_dfa_accept[{len(accept)}] = {{\n')
+    for a in accept:
+        f.write(f'    {a},\n')
+    f.write('};\n\n')
+
+    # keyword perfect hash
+    size, a, b, slots = perfect_hash(list(keywords.keys()))
+    f.write('struct keyword_entry {\n')
+    f.write('  const char *spelling;\n')
+    f.write('  uint8_t length;\n')
+    f.write('  uint8_t type;\n')
+    f.write('};\n\n')
+    f.write(f'static constexpr size_t keyword_table_size = {size};\n\n')
+    f.write('static constexpr size_t keyword_hash(const char *s, size_t len) {\n')
+    f.write('  auto b = (const unsigned char *)s;\n')
+    f.write(f'  return (len * {a} + b[0] * {b} + b[len - 1]) % keyword_table_size;\n')
+    f.write('}\n\n')
+    f.write('static constexpr keyword_entry keyword_table[keyword_table_size] = {\n')
+    for i in range(size):
+        if i in slots:
+            w = slots[i]
+            f.write(f'    {{"{w}", {len(w.encode("utf-8"))}, tok_{keywords[w]}}},\n')
+        else:
+            f.write('    {nullptr, 0, 0},\n')
+    f.write('};\n')
+
+
+
+with open('include/helion/binary_ops.inc', 'w') as f:
+    f.write('// generated by tools/scripts/generate_tokens.py. DO NOT MODIFY\n')
+    f.write('// included by src/helion/parser.cpp\n\n')
+
+    spellings = {tok: op for op, tok in operators.items()}
+    f.write('struct binary_op_info {\n')
+    f.write('  // -1 if the token is not a binary operator\n')
+    f.write('  int8_t prec;\n')
+    f.write('  bool right_assoc;\n')
+    f.write('  const char *spelling;\n')
+    f.write('};\n\n')
+    f.write('// indexed by tok_type\n')
+    f.write(f'static constexpr binary_op_info binary_ops[{len(tokens)}] = {{\n')
+    for tok in tokens:
+        if tok in binary_operators:
+            prec, assoc = binary_operators[tok]
+            right = 'true' if assoc == 'right' else 'false'
+            f.write(f'    {{{prec}, {right}, "{spellings[tok]}"}},  // {tok}\n')
+        else:
+            f.write(f'    {{-1, false, nullptr}},  // {tok}\n')
+    f.write('};\n')